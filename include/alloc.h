@@ -5,5 +5,13 @@
 
 void init_heap(void *heap, UINT32 heap_size);
 void *alloc(void *heap, UINT32 size);
+/* Wipe the block at ptr and return it to the heap, merged with its free
+ * neighbours */
+void dealloc(void *heap, void *ptr);
+/* Open a scope, the blocks allocated from now on belong to it */
+UINT32 heap_mark(void);
+/* Wipe and free the blocks of the scopes opened since heap_mark() returned
+ * mark */
+void heap_release(void *heap, UINT32 mark);
 
 #endif
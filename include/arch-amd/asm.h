@@ -57,6 +57,53 @@ static inline unsigned int cpuid_edx(unsigned value) {
   return res;
 }
 
+static inline unsigned int cpuid_ebx1(unsigned value, unsigned subleaf) {
+  unsigned int res, dummy;
+  asm volatile("cpuid"
+               : "=b"(res), "=a"(dummy), "+c"(subleaf)
+               : "a"(value)
+               : "edx");
+  return res;
+}
+
+#define CR0_MP 0x00000002 /* "Math" (fpu) Present */
+#define CR0_EM 0x00000004 /* EMulate FPU instructions */
+#define CR0_TS 0x00000008 /* Task Switched */
+
+#define CR4_FXSR 0x00000200    /* Fast FPU save/restore used by OS */
+#define CR4_XMM 0x00000400     /* enable SIMD/MMX2 to use except 16 */
+#define CR4_OSXSAVE 0x00040000 /* enable XSAVE and extended states */
+
+static inline unsigned long read_cr0(void) {
+  unsigned long res;
+  asm volatile("movl %%cr0,%0" : "=r"(res));
+  return res;
+}
+
+static inline void write_cr0(unsigned long value) {
+  asm volatile("movl %0,%%cr0" ::"r"(value));
+}
+
+static inline unsigned long read_cr4(void) {
+  unsigned long res;
+  asm volatile("movl %%cr4,%0" : "=r"(res));
+  return res;
+}
+
+static inline void write_cr4(unsigned long value) {
+  asm volatile("movl %0,%%cr4" ::"r"(value));
+}
+
+static inline unsigned long long xgetbv(unsigned int index) {
+  unsigned long long res;
+  asm volatile("xgetbv" : "=A"(res) : "c"(index));
+  return res;
+}
+
+static inline void xsetbv(unsigned int index, unsigned long long value) {
+  asm volatile("xsetbv" ::"c"(index), "A"(value));
+}
+
 static inline unsigned long long rdmsr(unsigned int addr) {
   unsigned long long res;
 
@@ -63,6 +63,16 @@ static inline void wrmsr(unsigned int addr, unsigned long long value) {
 
 */
 
+static inline unsigned long long xgetbv(unsigned int index) {
+  unsigned long long res;
+  asm volatile("xgetbv" : "=A"(res) : "c"(index));
+  return res;
+}
+
+static inline void xsetbv(unsigned int index, unsigned long long value) {
+  asm volatile("xsetbv" ::"c"(index), "A"(value));
+}
+
 static inline unsigned char inb(const unsigned short port) {
   unsigned char res;
   asm volatile("inb %1, %0" : "=a"(res) : "Nd"(port));
@@ -94,6 +94,7 @@
 #define CR4_VMXE 0x00002000/* enable VMX */
 #define CR4_SMXE 0x00004000/* enable SMX */
 #define CR4_PCIDE 0x00020000/* enable PCID */
+#define CR4_OSXSAVE 0x00040000/* enable XSAVE and extended states */
 
 #ifndef __ASSEMBLY__
 
@@ -50,6 +50,8 @@ struct ph {
  * ERROR_NO_MODULE
  */
 RESULT start_module(struct mbi *mbi);
+void load_module_prepare(struct mbi *mbi);
+void load_module_stride(const void *data, unsigned count);
 int extract_module(struct mbi *mbi, unsigned *entry_point);
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef __EVENT_LOG_H__
+#define __EVENT_LOG_H__
+
+/*
+ * \brief   header of event_log.c
+ */
+
+#include "platform.h"
+#include "tcg.h"
+
+/* event types of the TCG PC Client Specific Implementation Specification */
+enum TCG_EVENT_TYPE {
+  EV_NO_ACTION = 0x03,
+  EV_SEPARATOR = 0x04,
+  EV_COMPACT_HASH = 0x0c,
+  EV_IPL = 0x0d,
+};
+
+typedef struct {
+  UINT32 pcrIndex;
+  UINT32 eventType;
+  TPM_DIGEST digest;
+  UINT32 eventSize;
+  BYTE event[];
+} TCG_PCR_EVENT;
+
+/* Find the log of the BIOS through the ACPI TCPA table and skip its events.
+ * Returns false if there is no log. */
+bool event_log_init(void);
+/* Whether the range overlaps the log area that event_log_init() found */
+bool event_log_overlaps(const void *start, UINT32 len);
+/* Append an event, if there is a log and it has room left for it */
+void event_log_add(TPM_PCRINDEX pcr, UINT32 type, TPM_DIGEST digest,
+                   const void *data, UINT32 size);
+
+#endif
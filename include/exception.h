@@ -30,6 +30,7 @@ typedef enum tdERROR {
   ERROR_BUFFER_OVERFLOW,
   ERROR_TPM_BAD_OUTPUT_PARAM,
   ERROR_TPM_BAD_OUTPUT_AUTH,
+  ERROR_PCR_SHADOW,
   ERROR_TPM = 1 << 7,
 } ERROR;
 
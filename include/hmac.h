@@ -5,16 +5,22 @@
 
 #define HMAC_BLOCK_SIZE 64
 
+/* the SHA-1 states after the key XOR ipad and the key XOR opad block */
 typedef struct {
-  BYTE key[HMAC_BLOCK_SIZE];
+  TPM_DIGEST ipad;
+  TPM_DIGEST opad;
+} HMAC_Key;
+
+typedef struct {
+  TPM_DIGEST opad;
   SHA1_Context sctx;
 } HMAC_Context;
 
-/* EXCEPT: ERROR_SHA1_DATA_SIZE */
+void hmac_key(HMAC_Key *hkey, const BYTE *key, UINT32 keySize);
+void hmac_start(HMAC_Context *ctx, const HMAC_Key *hkey);
 RESULT hmac_init(HMAC_Context *ctx, const BYTE *key, UINT32 keySize);
 /* EXCEPT: ERROR_SHA1_DATA_SIZE */
 RESULT hmac(HMAC_Context *ctx, const void *data, UINT32 dataSize);
-/* EXCEPT: ERROR_SHA1_DATA_SIZE */
 RESULT hmac_finish(HMAC_Context *ctx);
 
 #endif
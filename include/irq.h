@@ -0,0 +1,19 @@
+#ifndef __IRQ_H__
+#define __IRQ_H__
+
+/*
+ * \brief   header of irq.c
+ */
+
+#include "platform.h"
+
+/* Install an IDT with the exception gates of the loader, and unmask the
+ * legacy irq and the PIT. Returns false if interrupts are not delivered,
+ * e.g. because the GIF is still clear. */
+bool irq_init(unsigned int irq);
+/* Halt until an interrupt arrives, but at most for the given microseconds */
+void irq_wait(unsigned int us);
+/* Restore the PIC and the IDT of the loader */
+void irq_exit(void);
+
+#endif
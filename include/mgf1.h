@@ -6,6 +6,9 @@
 extern const char *const xor_str;
 extern const unsigned int xor_str_size;
 
-BYTE *mgf1(BYTE *input, UINT32 inputLen, UINT32 outputLen);
+/* write the outputLen bytes long mask of input to output */
+void mgf1(const BYTE *input, UINT32 inputLen, BYTE *output, UINT32 outputLen);
+/* XOR the mask of input into data, in place */
+void mgf1_xor(const BYTE *input, UINT32 inputLen, BYTE *data, UINT32 dataLen);
 
 #endif
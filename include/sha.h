@@ -20,14 +20,30 @@
 
 typedef struct {
   UINT32 index;
-  UINT32 blocks;
+  UINT64 blocks;
   BYTE buffer[64 + 4];
   TPM_DIGEST hash;
 } SHA1_Context;
 
+typedef struct {
+  const BYTE *data;
+  UINT32 count;
+  SHA1_Context *ctx;
+} SHA1_Job;
+
 void sha1_init(SHA1_Context *ctx);
+void sha1_resume(SHA1_Context *ctx, const TPM_DIGEST *state);
 /* EXCEPT: ERROR_SHA1_DATA_SIZE */
 RESULT sha1(SHA1_Context *ctx, const void *val, UINT32 count);
+void sha1_stream(SHA1_Context *ctx, const void *val, UINT32 count);
+void sha1_multi(SHA1_Job *jobs, UINT32 count);
 void sha1_finish(SHA1_Context *ctx);
 
+#ifdef SHA1_SIMD
+/* Enable SSE state and select a vectorized SHA-1, respectively restore the
+ * previous state and the scalar SHA-1 */
+void sha1_simd_begin(void);
+void sha1_simd_end(void);
+#endif
+
 #endif
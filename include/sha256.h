@@ -0,0 +1,33 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+/*
+ * \brief   header of sha256.c
+ */
+
+#include "platform.h"
+
+#define SHA256_HASH_LEN 32
+
+typedef struct { BYTE digest[SHA256_HASH_LEN]; } SHA256_DIGEST;
+
+typedef struct {
+  UINT32 index;
+  UINT64 blocks;
+  BYTE buffer[64];
+  UINT32 state[8];
+  SHA256_DIGEST hash;
+} SHA256_Context;
+
+void sha256_init(SHA256_Context *ctx);
+void sha256_stream(SHA256_Context *ctx, const void *val, UINT32 count);
+void sha256_finish(SHA256_Context *ctx);
+
+#ifdef SHA1_SIMD
+/* Select the SHA-NI block function while sha1_simd_begin() has the SSE state
+ * enabled, respectively fall back to the scalar one */
+void sha256_simd_begin(void);
+void sha256_simd_end(void);
+#endif
+
+#endif
@@ -15,6 +15,7 @@
  * COPYING file for details.
  */
 
+#include "platform.h"
 #include "exception.h"
 
 #define TIS_BUFFER_SIZE 1024
@@ -87,6 +88,79 @@ enum TIS_STS_BITS {
   TIS_STS_RESERVED_0 = 1 << 0
 };
 
+enum TIS_INT_ENABLE_BITS {
+  TIS_INT_GLOBAL = 1u << 31,
+  TIS_INT_CMD_READY = 1 << 7,
+  TIS_INT_POLARITY = 3 << 3,
+  TIS_INT_LOCALITY_CHANGE = 1 << 2,
+  TIS_INT_STS_VALID = 1 << 1,
+  TIS_INT_DATA_AVAIL = 1 << 0,
+};
+
+enum TIS_INTF_CAPABILITY_BITS {
+  TIS_INTF_TRANSFER_SIZE_SHIFT = 9,
+  TIS_INTF_TRANSFER_SIZE_MASK = 3,
+  TIS_INTF_VERSION_SHIFT = 28,
+  TIS_INTF_VERSION_MASK = 7,
+  TIS_INTF_VERSION_1_3 = 2,
+};
+
+enum TIS_TIMEOUT {
+  TIS_TIMEOUT_A,
+  TIS_TIMEOUT_B,
+  TIS_TIMEOUT_C,
+  TIS_TIMEOUT_D,
+  TIS_DURATION_SHORT,
+  TIS_DURATION_MEDIUM,
+  TIS_DURATION_LONG,
+  TIS_TIMEOUT_MAX
+};
+
+#ifdef TIS_HOST
+/* Register accesses of the host bench, addr is the physical address that
+ * the firmware would access. Implemented by its TIS emulator. */
+unsigned int tis_host_read(unsigned long addr, unsigned int size);
+void tis_host_write(unsigned long addr, unsigned int size, unsigned int value);
+#endif
+
+/* Release builds do not trace */
+#if defined(TIS_TRACE) && defined(NDEBUG)
+#undef TIS_TRACE
+#endif
+
+#ifdef TIS_TRACE
+/* Phases of a command, as recorded by the trace */
+enum TIS_TRACE_PHASE {
+  TIS_TRACE_WRITE,   // until TPM_GO
+  TIS_TRACE_EXECUTE, // until the response is available
+  TIS_TRACE_READ,    // until the response is read
+  TIS_TRACE_PHASES
+};
+
+#define TIS_TRACE_RECORDS 32
+
+struct tis_trace_record {
+  UINT32 ordinal;
+  UINT16 in_size;
+  UINT16 out_size;
+  UINT32 ticks[TIS_TRACE_PHASES]; // TSC ticks of the phases
+};
+
+/* Trace the following commands into a ring of size records */
+void tis_trace_start(struct tis_trace_record *ring, unsigned int size);
+/* Print count, min/avg/max time and the average execution time per ordinal
+ * of the commands in the ring */
+void tis_trace_dump(void);
+#endif
+
+/* MMIO register accesses of the last tis_transmit() */
+extern unsigned int tis_mmio_count;
+/* timeouts in microseconds */
+extern unsigned int tis_timeouts[TIS_TIMEOUT_MAX];
+
+void tis_set_timeouts(enum TIS_TIMEOUT first, const UINT32 *values,
+                      unsigned int count);
+
 void tis_dump(void);
 enum TIS_TPM_VENDOR tis_init(void);
 /* EXCEPT: ERROR_TIS_LOCALITY_DEACTIVATE */
@@ -99,5 +173,16 @@ RESULT tis_deactivate_all(void);
 RESULT tis_access(enum TIS_LOCALITY locality, int force);
 /* EXCEPT: ERROR_TIS_TRANSMIT */
 RESULT tis_transmit(void);
+/* Split tis_transmit(): start a command, check whether its response is
+ * available and read the response. Only one command may be in flight. */
+/* EXCEPT: ERROR_TIS_TRANSMIT */
+RESULT tis_submit(void);
+bool tis_poll(void);
+/* EXCEPT: ERROR_TIS_TRANSMIT */
+RESULT tis_complete(void);
+/* Instead of tis_complete(), e.g. for TPM_ContinueSelfTest: the next command
+ * waits for whatever time of the submitted one remains, also after the
+ * locality was released. */
+void tis_detach(void);
 
 #endif
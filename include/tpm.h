@@ -25,10 +25,22 @@ typedef struct tdHEAP_DATA {
   BYTE *data;
 } HEAP_DATA;
 
+/* Data that is not copied out of the buffer it is in. A view of
+ * tis_buffers.out is only valid until the next TPM command. */
+typedef struct tdDATA_VIEW {
+  UINT32 dataSize;
+  const BYTE *data;
+} DATA_VIEW;
+
 // Generate RESULT types
 RESULT_GEN(TPM_PCRVALUE);
 RESULT_GEN(HEAP_DATA);
+RESULT_GEN(DATA_VIEW);
 RESULT_GEN(TPM_STORED_DATA12);
+RESULT_GEN(TPM_NONCE);
+
+/* Hands out a fresh nonceOdd for each authorized command */
+typedef RESULT_(TPM_NONCE) (*NONCE_SOURCE)(void);
 
 ///////////////////////////////////////////////////////////////////////////
 /*
@@ -39,23 +51,59 @@ RESULT_GEN(TPM_STORED_DATA12);
  * ERROR_TPM_BAD_OUTPUT_AUTH (only for authorized commands)
  */
 RESULT TPM_Startup(TPM_STARTUP_TYPE startupType_in);
-RESULT TPM_GetRandom(BYTE *randomBytes_out /* out */, UINT32 bytesRequested_in);
+/* Start the rest of the self-test without waiting for it. The next command
+ * waits for whatever time of it remains. Except: ERROR_TIS_TRANSMIT */
+RESULT TPM_ContinueSelfTest_submit(void);
+/* The TPM may return fewer bytes than requested */
+RESULT TPM_GetRandom(BYTE *randomBytes_out /* out */, UINT32 bytesRequested_in,
+                     UINT32 *randomBytesSize_out /* out */);
+/* Only for capabilities that are answered with a list of respCount_in UINT32
+ * values, e.g. TPM_CAP_PROP_TIS_TIMEOUT. */
+RESULT TPM_GetCapability(TPM_CAPABILITY_AREA capArea_in, UINT32 subCap_in,
+                         UINT32 *resp_out /* out */, UINT32 respCount_in);
 RESULT_(TPM_PCRVALUE) TPM_PCRRead(TPM_PCRINDEX pcrIndex_in);
+/* TPM_PCRRead() that reads PCRs 17-19 only once and follows their extends
+ * Except: ERROR_PCR_SHADOW (debug builds only) */
+RESULT_(TPM_PCRVALUE) tpm_pcr_read(TPM_PCRINDEX pcrIndex_in);
+/* Forget what was cached before the late launch, so that the first
+ * tpm_pcr_read() of each PCR and the first large NV command ask the TPM */
+void tpm_cache_reset(void);
 RESULT_(TPM_PCRVALUE)
 TPM_Extend(TPM_PCRINDEX pcrNum_in, TPM_DIGEST inDigest_in);
+/* TPM_Extend() in two halves, so that the caller can work while the TPM
+ * computes. No other command may be sent in between. */
+RESULT TPM_Extend_submit(TPM_PCRINDEX pcrNum_in, TPM_DIGEST inDigest_in);
+RESULT_(TPM_PCRVALUE) TPM_Extend_complete(void);
 /* Only populates the authHandle and nonceEven fields. nonceOdd and
- * and continueAuthSession must be populated by the caller. */
+ * and continueAuthSession must be populated by the caller.
+ * Except: ERROR_BUFFER_OVERFLOW if the heap has no room for the session */
 RESULT TPM_OIAP(TPM_SESSION **session);
 RESULT TPM_OSAP(TPM_ENTITY_TYPE entityType_in, UINT32 entityValue_in,
                 TPM_NONCE nonceOddOSAP, TPM_SESSION **session);
+/* Reuse *session if it is still open, otherwise start an OIAP session, and
+ * prepare it for the next command, which closes it. */
+RESULT tpm_session_oiap(TPM_SESSION **session, TPM_NONCE nonceOdd);
 RESULT TPM_NV_WriteValueAuth(const BYTE *data_in, UINT32 dataSize_in,
                              TPM_NV_INDEX nvIndex_in, UINT32 offset_in,
                              TPM_AUTHDATA nv_auth, TPM_SESSION **session);
-RESULT_(HEAP_DATA)
+/* Returns a view of the data in tis_buffers.out */
+RESULT_(DATA_VIEW)
 TPM_NV_ReadValue(TPM_NV_INDEX nvIndex_in, UINT32 offset_in, UINT32 dataSize_in,
                  OPTION(TPM_AUTHDATA) ownerAuth_in, TPM_SESSION **session);
+/* Write or read a NV space of any size, split into as few commands as the
+ * buffers of the TIS and the TPM allow. The session of a write stays open
+ * until the last command, which continues it as asked. Every command after
+ * the first takes its nonceOdd from next_nonce. A read is a view of
+ * tis_buffers.out if it takes one command, otherwise it is on the heap.
+ * Except: ERROR_BUFFER_OVERFLOW if the heap has no room for it */
+RESULT tpm_nv_write(const BYTE *data, UINT32 size, TPM_NV_INDEX index,
+                    TPM_AUTHDATA nv_auth, TPM_SESSION **session,
+                    NONCE_SOURCE next_nonce);
+RESULT_(DATA_VIEW) tpm_nv_read(TPM_NV_INDEX index, UINT32 size);
+/* inData_in is a marshalled TPM_STORED_DATA12, it may be a view of
+ * tis_buffers.out */
 RESULT_(HEAP_DATA)
-TPM_Unseal(TPM_STORED_DATA12 inData_in /* in */, TPM_KEY_HANDLE parentHandle_in,
+TPM_Unseal(DATA_VIEW inData_in /* in */, TPM_KEY_HANDLE parentHandle_in,
            TPM_AUTHDATA parentAuth, TPM_SESSION **parentSession,
            TPM_AUTHDATA dataAuth, TPM_SESSION **dataSession);
 RESULT_(TPM_STORED_DATA12)
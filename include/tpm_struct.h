@@ -39,6 +39,9 @@ void unmarshal_array(void *data /* in/out */, UINT32 size, Unpack_Context *ctx,
                      SHA1_Context *sctx);
 void unmarshal_ptr(void *ptr /* in/out */, UINT32 size, Unpack_Context *ctx,
                    SHA1_Context *sctx);
+/* Like unmarshal_ptr(), but *ptr points into the unpack buffer */
+void unmarshal_view(const BYTE **ptr /* out */, UINT32 size,
+                    Unpack_Context *ctx, SHA1_Context *sctx);
 void marshal_TPM_PCR_SELECTION(const TPM_PCR_SELECTION *select,
                                Pack_Context *ctx, SHA1_Context *sctx);
 void unmarshal_TPM_PCR_SELECTION(TPM_PCR_SELECTION *select /* in/out */,
@@ -57,6 +60,9 @@ void unmarshal_TPM_STORED_DATA12(TPM_STORED_DATA12 *data /* in/out */,
 UINT32 sizeof_TPM_PCR_SELECTION(const TPM_PCR_SELECTION *select);
 UINT32 sizeof_TPM_PCR_INFO_LONG(const TPM_PCR_INFO_LONG *pcrInfo);
 UINT32 sizeof_TPM_STORED_DATA12(const TPM_STORED_DATA12 *storedData);
+/* The size of the marshalled TPM_STORED_DATA12 at the start of data, or 0 if
+ * it has a wrong tag or does not fit into dataSize bytes */
+UINT32 check_TPM_STORED_DATA12(const BYTE *data, UINT32 dataSize);
 
 /* APIs to generate specific TPM structs */
 
@@ -66,14 +72,12 @@ TPM_ENCAUTH encAuth_gen(TPM_AUTHDATA entityAuthData, TPM_SECRET sharedSecret,
 TPM_SECRET sharedSecret_gen(TPM_AUTHDATA auth, TPM_NONCE nonceEvenOSAP,
                             TPM_NONCE nonceOddOSAP);
 
-/* Helper functions to pack/unpack just one struct into a buffer, returns the
- * number of bytes packed, or the unpacked struct */
+/* Helper functions to pack just one struct into a buffer, returns the number
+ * of bytes packed */
 UINT32 pack_TPM_PCR_INFO_LONG(BYTE *data /* out */, UINT32 dataSize,
                               const TPM_PCR_INFO_LONG *pcrInfo /* in */);
 UINT32 pack_TPM_STORED_DATA12(BYTE *data /* out */, UINT32 dataSize,
                               const TPM_STORED_DATA12 *storedData /* in */);
-TPM_STORED_DATA12 unpack_TPM_STORED_DATA12(const BYTE *data /* in */,
-                                           UINT32 dataSize);
 struct extracted_TPM_STORED_DATA12 {
   UINT32 dataSize;
   BYTE *data;
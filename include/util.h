@@ -87,6 +87,7 @@ void dump_exception(EXCEPTION e);
 void fail(void) __attribute__((noreturn));
 void exit(unsigned status) __attribute__((noreturn));
 void show_hash(const char *s, TPM_DIGEST hash);
+void show_hash_bytes(const char *s, const BYTE *hash, UINT32 len);
 
 /* helper functions for handling command-line arguments */
 int indexOf(char *sub, char *str);
@@ -7,11 +7,18 @@
 
 struct mem_node {
   UINT32 size;           /* size of this data, in blocks,
-                            the most significant bit is the occupied (not free) flag */
+                            the most significant bit is the occupied (not
+                            free) flag, the bits below it the scope of an
+                            occupied node */
   struct mem_node *next; /* where the next
                   mem_node is located, is NULL if there is no next node */
 };
-enum mem_node_consts { MEM_NODE_OCCUPIED_FLAG = 0x80000000 };
+enum mem_node_consts {
+  MEM_NODE_OCCUPIED_FLAG = 0x80000000,
+  MEM_NODE_SCOPE_SHIFT = 24,
+  MEM_NODE_SCOPE_MAX = 0x7f,
+  MEM_NODE_SIZE_MASK = 0x00ffffff
+};
 
 #define BLOCK_SIZE 8 // must be at least sizeof(struct mem_node)
 #define BITS_ALIGN 3 // must be log_2 of BLOCK_SIZE
@@ -19,38 +26,101 @@ enum mem_node_consts { MEM_NODE_OCCUPIED_FLAG = 0x80000000 };
 #error "BITS_ALIGN is not log_2 of BLOCK_SIZE"
 #endif
 
+/* The scope of new allocations, see heap_mark() */
+static UINT32 heap_scope;
+
 void init_heap(void *heap, UINT32 heap_size) {
   ASSERT(((unsigned long)heap & 7) == 0);
-  ASSERT((heap_size & MEM_NODE_OCCUPIED_FLAG) == 0);
+  ASSERT(((heap_size >> BITS_ALIGN) & ~MEM_NODE_SIZE_MASK) == 0);
   struct mem_node *n = heap;
   *n = (struct mem_node){.size = (heap_size >> BITS_ALIGN) - 1, .next = NULL};
+  heap_scope = 0;
 }
 
+/**
+ * First fit walk over the node list. There are no size-class bins, the list
+ * of an 8K heap has a few dozen nodes at most, and a binned block could not
+ * be merged with its free neighbours.
+ */
 void *alloc(void *heap, UINT32 size) {
   struct mem_node *n = heap, *next_node = NULL;
   ASSERT(size > 0);
-  UINT32 blocks =
-      (size >> BITS_ALIGN) + 1; // FIXME: we might be overallocating here!
+  UINT32 blocks = (size + BLOCK_SIZE - 1) >> BITS_ALIGN;
 
-  for (; n && ((blocks > (n->size & ~MEM_NODE_OCCUPIED_FLAG)) ||
-               (n->size & MEM_NODE_OCCUPIED_FLAG));
+  // the size of a free node has no other bits set
+  for (; n && ((blocks > n->size) || (n->size & MEM_NODE_OCCUPIED_FLAG));
        n = n->next) {
   }
   if (!n)
     return NULL;
 
-  UINT32 n_size = n->size & ~MEM_NODE_OCCUPIED_FLAG;
+  UINT32 n_size = n->size;
 
   if (blocks < n_size) {
     next_node = n + (blocks + 1);
-    *next_node = (struct mem_node){.size = (n_size - (blocks + 1)) &
-                                           ~MEM_NODE_OCCUPIED_FLAG,
-                                   .next = n->next};
+    *next_node =
+        (struct mem_node){.size = n_size - (blocks + 1), .next = n->next};
   } else {
     next_node = n->next;
   }
 
-  *n = (struct mem_node){.size = blocks | MEM_NODE_OCCUPIED_FLAG,
+  *n = (struct mem_node){.size = blocks | heap_scope << MEM_NODE_SCOPE_SHIFT |
+                                 MEM_NODE_OCCUPIED_FLAG,
                          .next = next_node};
   return (void *)(n + 1);
 }
+
+/* Mark n as free and wipe its data, it may have held a secret */
+static void free_node(struct mem_node *n) {
+  n->size &= MEM_NODE_SIZE_MASK;
+  memset(n + 1, 0, n->size << BITS_ALIGN);
+}
+
+/* Merge n with the node after it, if both are free */
+static void merge_next(struct mem_node *n) {
+  struct mem_node *next = n->next;
+  if (next && !(n->size & MEM_NODE_OCCUPIED_FLAG) &&
+      !(next->size & MEM_NODE_OCCUPIED_FLAG)) {
+    n->size += next->size + 1;
+    n->next = next->next;
+  }
+}
+
+void dealloc(void *heap, void *ptr) {
+  struct mem_node *n = heap, *prev = NULL;
+  if (!ptr)
+    return;
+
+  for (; n && n + 1 != ptr; n = n->next)
+    prev = n;
+  ASSERT(n && (n->size & MEM_NODE_OCCUPIED_FLAG));
+
+  // no two free nodes are next to each other
+  free_node(n);
+  merge_next(n);
+  if (prev)
+    merge_next(prev);
+}
+
+UINT32 heap_mark(void) {
+  ASSERT(heap_scope < MEM_NODE_SCOPE_MAX);
+  return heap_scope++;
+}
+
+void heap_release(void *heap, UINT32 mark) {
+  struct mem_node *n = heap, *prev = NULL;
+  ASSERT(mark < heap_scope);
+
+  for (; n; prev = n, n = n->next) {
+    if ((n->size & MEM_NODE_OCCUPIED_FLAG) &&
+        ((n->size & ~MEM_NODE_OCCUPIED_FLAG) >> MEM_NODE_SCOPE_SHIFT) > mark)
+      free_node(n);
+    // n is merged into prev, or the next node into n
+    if (prev && !(prev->size & MEM_NODE_OCCUPIED_FLAG)) {
+      merge_next(prev);
+      if (prev->next != n)
+        n = prev;
+    }
+  }
+  heap_scope = mark;
+}
@@ -5,6 +5,7 @@
  *
  * \revisions by: robert sutton rpsutton@syr.edu
  * \1. added support for multiboot load : 6 feb 2014
+ * \2. segments of the first module can be loaded while it is hashed
  *
  */
 /*
@@ -24,6 +25,9 @@
 #include "elf.h"
 #include "alloc.h"
 #include "util.h"
+#ifdef EVENT_LOG
+#include "event_log.h"
+#endif
 
 enum {
   EAX,
@@ -71,11 +75,52 @@ static void gen_elf_segment(void *target, void *src, unsigned len,
   byte_out(0xAA); /* STOSB */
 }
 
-RESULT start_module(struct mbi *mbi) {
+/* a file range of the first module and where it has to be loaded */
+struct load_segment {
+  void *target;
+  void *src;
+  unsigned len;
+  unsigned fill;
+};
+
+/* what find_segments() does with each segment */
+typedef void (*segment_fn)(const struct load_segment *s);
+
+/* the segments that load_module_prepare() copies while hashing, an image
+ * with more of them is loaded by the trampoline only */
+#define MAX_LOAD_SEGMENTS 16
+static struct load_segment segments[MAX_LOAD_SEGMENTS];
+static unsigned segment_count; // may be larger than MAX_LOAD_SEGMENTS
+static unsigned segment_entry;
+static bool segments_loaded;
+
+/* the IVT, the BDA, the EBDA and the BIOS with the ACPI RSDP */
+#define LOW_MEMORY_END 0x100000
+#define MMAP_AVAILABLE 1
+
+extern char g_begin[], g_end[];
+
+static void keep_segment(const struct load_segment *s) {
+  if (segment_count < MAX_LOAD_SEGMENTS)
+    segments[segment_count] = *s;
+  segment_count++;
+}
+
+static void gen_segment(const struct load_segment *s) {
+  gen_elf_segment(s->target, s->src, s->len, s->fill);
+}
+
+/* EXCEPT:
+ * ERROR_BAD_ELF_HEADER
+ *
+ * Find the load segments and the entry point of a multiboot or ELF module,
+ * and pass the segments to found in the order of the headers.
+ */
+static RESULT find_segments(struct module *m, segment_fn found) {
   RESULT ret = {.exception.error = NONE};
-  struct module *m;
   struct mbh *mb;
-  struct eh *elf = NULL;
+  struct eh *elf;
+  struct load_segment segment;
 
   unsigned load_end;
   unsigned bss_offset;
@@ -83,18 +128,6 @@ RESULT start_module(struct mbi *mbi) {
   unsigned int *elf_magic;
   unsigned short *elf_class_data;
 
-  ERROR(mbi->mods_count == 0, ERROR_NO_MODULE, "No module to start.\n");
-
-  // skip module after loading
-  m = (struct module *)mbi->mods_addr;
-  mbi->mods_addr += sizeof(struct module);
-  mbi->mods_count--;
-  mbi->cmdline = m->string;
-
-  // switch it on unconditionally, we assume that m->string is always
-  // initialized
-  SET_FLAG(mbi->flags, MBI_FLAG_CMDLINE);
-
   // search for multiboot header
   unsigned *ptr;
   for (ptr = (unsigned *)m->mod_start; ptr < (unsigned *)m->mod_start + 8192;
@@ -119,10 +152,14 @@ RESULT start_module(struct mbi *mbi) {
     }
 
     // create multiboot segment
-    gen_elf_segment(
-        (UINT32 *)mb->load_addr,
-        ((UINT32 *)mb - ((UINT32 *)mb->header_addr - (UINT32 *)mb->load_addr)),
-        load_end - mb->load_addr, bss_offset);
+    segment = (struct load_segment){
+        .target = (UINT32 *)mb->load_addr,
+        .src = ((UINT32 *)mb -
+                ((UINT32 *)mb->header_addr - (UINT32 *)mb->load_addr)),
+        .len = load_end - mb->load_addr,
+        .fill = bss_offset};
+    found(&segment);
+    segment_entry = mb->entry_addr;
 
   } else {
     // check elf header
@@ -143,18 +180,157 @@ RESULT start_module(struct mbi *mbi) {
           (struct ph *)(m->mod_start + elf->e_phoff + i * elf->e_phentsize);
       if (ph->p_type != 1)
         continue;
-      gen_elf_segment(ph->p_paddr, (void *)(m->mod_start + ph->p_offset),
-                      ph->p_filesz, ph->p_memsz - ph->p_filesz);
+      segment = (struct load_segment){
+          .target = ph->p_paddr,
+          .src = (void *)(m->mod_start + ph->p_offset),
+          .len = ph->p_filesz,
+          .fill = ph->p_memsz - ph->p_filesz};
+      found(&segment);
     }
+    segment_entry = elf->e_entry;
   }
 
-  gen_mov(EAX, MBI_MAGIC2);
-  if (elf != NULL) {
-    gen_mov(EDX, (unsigned)elf->e_entry);
+  return ret;
+}
+
+static bool overlaps(const void *start, unsigned len, const void *start2,
+                     unsigned len2) {
+  return (const char *)start < (const char *)start2 + len2 &&
+         (const char *)start2 < (const char *)start + len;
+}
+
+/**
+ * Whether the range overlaps memory that the memory map does not list as
+ * available RAM, e.g. the ACPI tables and ACPI NVS.
+ */
+static bool overlaps_reserved(struct mbi *mbi, const void *start,
+                              unsigned len) {
+  UINT64 begin = (unsigned)start, end = begin + len;
+
+  for (unsigned offset = 0; offset < mbi->mmap_length;) {
+    struct mmap *e = (struct mmap *)(mbi->mmap_addr + offset);
+    if (e->type != MMAP_AVAILABLE && begin < e->base + e->length &&
+        e->base < end)
+      return true;
+    offset += e->size + sizeof(e->size);
+  }
+  return false;
+}
+
+/**
+ * Decide whether the segments of the first module can be copied to their
+ * load addresses while the module is hashed, see load_module_stride(). This
+ * is only done if every segment lies inside the module file, and if no
+ * segment with its bss wraps around, overlaps another one, or overwrites
+ * low memory, reserved or ACPI memory, the event log, SABLE, the
+ * trampoline, the MBI or any module or command line. The order of the copies
+ * then does not matter. Otherwise the trampoline loads the module, as it
+ * does for images with more than MAX_LOAD_SEGMENTS segments.
+ */
+void load_module_prepare(struct mbi *mbi) {
+  struct module *m = (struct module *)mbi->mods_addr;
+  RESULT find_ret;
+
+  segments_loaded = false;
+  segment_count = 0;
+  // without a memory map nothing tells where the firmware keeps its tables
+  if (!mbi->mods_count || !CHECK_FLAG(mbi->flags, MBI_FLAG_MMAP))
+    return;
+  find_ret = find_segments(m, keep_segment);
+  if (find_ret.exception.error || segment_count > MAX_LOAD_SEGMENTS)
+    return;
+
+  for (unsigned i = 0; i < segment_count; i++) {
+    struct load_segment *s = segments + i;
+    unsigned size = s->len + s->fill;
+    if ((char *)s->src < (char *)m->mod_start ||
+        (char *)s->src + s->len > (char *)m->mod_end ||
+        (char *)s->src + s->len < (char *)s->src || size < s->len ||
+        (char *)s->target + size < (char *)s->target ||
+        (unsigned)s->target < LOW_MEMORY_END ||
+        overlaps_reserved(mbi, s->target, size) ||
+        overlaps(s->target, size, g_begin, g_end - g_begin) ||
+        overlaps(s->target, size, (void *)TRAMPOLINE_ADDRESS, 4096) ||
+        overlaps(s->target, size, mbi, sizeof(struct mbi)) ||
+        overlaps(s->target, size, m, mbi->mods_count * sizeof(*m)) ||
+        overlaps(s->target, size, (void *)mbi->mmap_addr, mbi->mmap_length))
+      return;
+#ifdef EVENT_LOG
+    if (event_log_overlaps(s->target, size))
+      return;
+#endif
+    if (CHECK_FLAG(mbi->flags, MBI_FLAG_CMDLINE) &&
+        overlaps(s->target, size, (void *)mbi->cmdline,
+                 strlen((char *)mbi->cmdline) + 1))
+      return;
+    for (unsigned j = 0; j < mbi->mods_count; j++)
+      if (overlaps(s->target, size, (void *)m[j].mod_start,
+                   m[j].mod_end - m[j].mod_start) ||
+          overlaps(s->target, size, (void *)m[j].string,
+                   strlen((char *)m[j].string) + 1))
+        return;
+    // the trampoline copies and clears overlapping segments in order
+    for (unsigned j = 0; j < i; j++)
+      if (overlaps(s->target, size, segments[j].target,
+                   segments[j].len + segments[j].fill))
+        return;
+  }
+  segments_loaded = true;
+}
+
+/**
+ * Copy the parts of the segments that lie in the given range of the first
+ * module, which has just been hashed and is still cached. All of the module
+ * has to be passed in this way once load_module_prepare() succeeded.
+ */
+void load_module_stride(const void *data, unsigned count) {
+  const BYTE *begin = data;
+
+  if (!segments_loaded)
+    return;
+
+  for (unsigned i = 0; i < segment_count; i++) {
+    const BYTE *src = segments[i].src;
+    const BYTE *from = src > begin ? src : begin;
+    const BYTE *to = src + segments[i].len < begin + count
+                         ? src + segments[i].len
+                         : begin + count;
+    if (from < to)
+      memcpy((BYTE *)segments[i].target + (from - src), from, to - from);
+  }
+}
+
+RESULT start_module(struct mbi *mbi) {
+  RESULT ret = {.exception.error = NONE};
+  struct module *m;
+
+  ERROR(mbi->mods_count == 0, ERROR_NO_MODULE, "No module to start.\n");
+
+  // skip module after loading
+  m = (struct module *)mbi->mods_addr;
+  mbi->mods_addr += sizeof(struct module);
+  mbi->mods_count--;
+  mbi->cmdline = m->string;
+
+  // switch it on unconditionally, we assume that m->string is always
+  // initialized
+  SET_FLAG(mbi->flags, MBI_FLAG_CMDLINE);
+
+  if (!segments_loaded) {
+    RESULT find_ret = find_segments(m, gen_segment);
+    THROW(find_ret.exception);
   } else {
-    gen_mov(EDX, (unsigned)mb->entry_addr);
+    // segments copied while hashing only need their bss to be cleared
+    for (unsigned i = 0; i < segment_count; i++) {
+      struct load_segment *s = segments + i;
+      gen_elf_segment((char *)s->target + s->len, (char *)s->src + s->len, 0,
+                      s->fill);
+    }
   }
 
+  gen_mov(EAX, MBI_MAGIC2);
+  gen_mov(EDX, segment_entry);
+
   out_info("jumping to next segment...\n");
   wait(1000);
   gen_jmp_edx();
@@ -0,0 +1,188 @@
+/*
+ * \brief   TCG 1.2 event log. SABLE appends its events to the log of the
+ * BIOS, which the ACPI TCPA table points to, so that the kernel finds them
+ * behind the SRTM events, e.g. in binary_bios_measurements under Linux.
+ */
+
+#ifndef ISABELLE
+#include "util.h"
+#include "event_log.h"
+
+#define RSDP_SCAN_START 0xe0000
+#define RSDP_SCAN_END 0x100000
+#define BDA_EBDA_SEGMENT 0x40e
+#define EBDA_SCAN_SIZE 1024
+
+struct acpi_header {
+  char signature[4];
+  UINT32 length;
+  BYTE revision;
+  BYTE checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  UINT32 oem_revision;
+  UINT32 creator_id;
+  UINT32 creator_revision;
+};
+
+struct acpi_rsdp {
+  char signature[8];
+  BYTE checksum;
+  char oem_id[6];
+  BYTE revision;
+  UINT32 rsdt;
+  UINT32 length;
+  UINT64 xsdt;
+  BYTE ext_checksum;
+  BYTE reserved[3];
+};
+
+struct acpi_tcpa {
+  struct acpi_header header;
+  UINT16 platform_class;
+  union {
+    struct {
+      UINT32 laml;
+      UINT64 lasa;
+    } client;
+    struct {
+      UINT16 reserved;
+      UINT32 laml;
+      UINT64 lasa;
+    } server;
+  };
+};
+
+/* the log area and the end of the last event in it */
+static struct {
+  BYTE *begin;
+  BYTE *next;
+  BYTE *end;
+} event_log;
+
+static BYTE acpi_checksum(const void *start, UINT32 len) {
+  const BYTE *p = start;
+  BYTE sum = 0;
+
+  while (len--)
+    sum += *p++;
+  return sum;
+}
+
+static struct acpi_rsdp *scan_rsdp(UINT32 start, UINT32 end) {
+  // the RSDP lies on a 16 byte boundary, the checksum covers ACPI 1.0 only
+  for (start = (start + 15) & ~15u; start < end; start += 16) {
+    struct acpi_rsdp *rsdp = (struct acpi_rsdp *)start;
+    if (!memcmp(rsdp->signature, "RSD PTR ", sizeof(rsdp->signature)) &&
+        !acpi_checksum(rsdp, 20))
+      return rsdp;
+  }
+  return NULL;
+}
+
+static UINT32 ebda_base(void) {
+  UINT16 *segment = (UINT16 *)BDA_EBDA_SEGMENT;
+
+  // gcc takes pointers into the first page for invalid
+  asm("" : "+r"(segment));
+  return (UINT32)*segment << 4;
+}
+
+static struct acpi_tcpa *find_tcpa(void) {
+  UINT32 ebda = ebda_base();
+  struct acpi_rsdp *rsdp = NULL;
+  struct acpi_header *sdt;
+  UINT32 entry_size = 4;
+
+  if (ebda)
+    rsdp = scan_rsdp(ebda, ebda + EBDA_SCAN_SIZE);
+  if (!rsdp)
+    rsdp = scan_rsdp(RSDP_SCAN_START, RSDP_SCAN_END);
+  if (!rsdp)
+    return NULL;
+
+  // prefer the XSDT, as long as it is below 4G
+  sdt = (struct acpi_header *)rsdp->rsdt;
+  if (rsdp->revision >= 2 && rsdp->xsdt && !(rsdp->xsdt >> 32)) {
+    sdt = (struct acpi_header *)(UINT32)rsdp->xsdt;
+    entry_size = 8;
+  }
+  if (!sdt || acpi_checksum(sdt, sdt->length))
+    return NULL;
+
+  for (UINT32 offset = sizeof(*sdt); offset + entry_size <= sdt->length;
+       offset += entry_size) {
+    UINT32 *entry = (UINT32 *)((BYTE *)sdt + offset);
+    // skip XSDT entries above 4G
+    if (entry_size == 8 && entry[1])
+      continue;
+    struct acpi_header *table = (struct acpi_header *)entry[0];
+    if (table && !memcmp(table->signature, "TCPA", 4) &&
+        table->length >= sizeof(struct acpi_tcpa) &&
+        !acpi_checksum(table, table->length))
+      return (struct acpi_tcpa *)table;
+  }
+  return NULL;
+}
+
+bool event_log_init(void) {
+  struct acpi_tcpa *tcpa = find_tcpa();
+  UINT32 laml;
+  UINT64 lasa;
+
+  event_log.begin = event_log.next = event_log.end = NULL;
+  if (!tcpa)
+    return false;
+
+  // platform class 1 is the server layout of the table
+  if (tcpa->platform_class == 1) {
+    laml = tcpa->server.laml;
+    lasa = tcpa->server.lasa;
+  } else {
+    laml = tcpa->client.laml;
+    lasa = tcpa->client.lasa;
+  }
+  if (!lasa || (lasa + laml) >> 32)
+    return false;
+
+  BYTE *p = (BYTE *)(UINT32)lasa;
+  event_log.begin = p;
+  event_log.end = p + laml;
+
+  // the log ends with an empty event, a truncated one leaves no room
+  while (p + sizeof(TCG_PCR_EVENT) <= event_log.end) {
+    TCG_PCR_EVENT *event = (TCG_PCR_EVENT *)p;
+    if (!event->eventType && !event->eventSize)
+      break;
+    if (event->eventSize > (UINT32)(event_log.end - p) - sizeof(*event))
+      p = event_log.end;
+    else
+      p += sizeof(TCG_PCR_EVENT) + event->eventSize;
+  }
+  event_log.next = p;
+  return true;
+}
+
+bool event_log_overlaps(const void *start, UINT32 len) {
+  return event_log.begin && (const BYTE *)start < event_log.end &&
+         event_log.begin < (const BYTE *)start + len;
+}
+
+void event_log_add(TPM_PCRINDEX pcr, UINT32 type, TPM_DIGEST digest,
+                   const void *data, UINT32 size) {
+  TCG_PCR_EVENT *event = (TCG_PCR_EVENT *)event_log.next;
+
+  // keep room for the empty event that terminates the log
+  if (!event || size > (UINT32)(event_log.end - event_log.next) ||
+      event_log.next + 2 * sizeof(TCG_PCR_EVENT) + size > event_log.end)
+    return;
+
+  event->pcrIndex = pcr;
+  event->eventType = type;
+  event->digest = digest;
+  event->eventSize = size;
+  memcpy(event->event, data, size);
+  event_log.next += sizeof(TCG_PCR_EVENT) + size;
+  memset(event_log.next, 0, sizeof(TCG_PCR_EVENT));
+}
+#endif
@@ -3,33 +3,50 @@
 #include "hmac.h"
 #include "util.h"
 
-typedef struct HMAC_OPad { BYTE pad[HMAC_BLOCK_SIZE]; } HMAC_OPad;
-typedef HMAC_OPad HMAC_IPad;
-
-RESULT hmac_init(HMAC_Context *ctx, const BYTE *key, UINT32 keySize) {
-  RESULT ret = {.exception.error = NONE};
-  RESULT sha1_ret;
-  HMAC_OPad ipad;
-
-  memset(ctx->key, 0, HMAC_BLOCK_SIZE);
-  memset(ipad.pad, 0x36, HMAC_BLOCK_SIZE);
+/**
+ * Compress the two key blocks once, so that every HMAC with this key only
+ * hashes the message and a single outer block.
+ */
+void hmac_key(HMAC_Key *hkey, const BYTE *key, UINT32 keySize) {
+  SHA1_Context sctx;
+  BYTE pad[HMAC_BLOCK_SIZE];
 
+  memset(pad, 0, HMAC_BLOCK_SIZE);
   if (keySize <= HMAC_BLOCK_SIZE)
-    memcpy(ctx->key, key, keySize);
+    memcpy(pad, key, keySize);
   else {
-    sha1_init(&ctx->sctx);
-    sha1_ret = sha1(&ctx->sctx, key, keySize);
-    THROW(sha1_ret.exception);
-    sha1_finish(&ctx->sctx);
-    memcpy(ctx->key, ctx->sctx.hash.digest, sizeof(TPM_DIGEST));
+    sha1_init(&sctx);
+    sha1_stream(&sctx, key, keySize);
+    sha1_finish(&sctx);
+    memcpy(pad, sctx.hash.digest, sizeof(TPM_DIGEST));
   }
 
-  do_xor(ipad.pad, ctx->key, ipad.pad, HMAC_BLOCK_SIZE);
+  for (unsigned i = 0; i < HMAC_BLOCK_SIZE; i++)
+    pad[i] ^= 0x36;
+  sha1_init(&sctx);
+  sha1_stream(&sctx, pad, HMAC_BLOCK_SIZE);
+  hkey->ipad = sctx.hash;
 
-  sha1_init(&ctx->sctx);
-  sha1_ret = sha1(&ctx->sctx, ipad.pad, HMAC_BLOCK_SIZE);
-  THROW(sha1_ret.exception);
+  for (unsigned i = 0; i < HMAC_BLOCK_SIZE; i++)
+    pad[i] ^= 0x36 ^ 0x5c;
+  sha1_init(&sctx);
+  sha1_stream(&sctx, pad, HMAC_BLOCK_SIZE);
+  hkey->opad = sctx.hash;
+
+  memset(pad, 0, HMAC_BLOCK_SIZE);
+}
 
+void hmac_start(HMAC_Context *ctx, const HMAC_Key *hkey) {
+  ctx->opad = hkey->opad;
+  sha1_resume(&ctx->sctx, &hkey->ipad);
+}
+
+RESULT hmac_init(HMAC_Context *ctx, const BYTE *key, UINT32 keySize) {
+  RESULT ret = {.exception.error = NONE};
+  HMAC_Key hkey;
+
+  hmac_key(&hkey, key, keySize);
+  hmac_start(ctx, &hkey);
   return ret;
 }
 
@@ -42,19 +59,11 @@ RESULT hmac(HMAC_Context *ctx, const void *data, UINT32 dataSize) {
 
 RESULT hmac_finish(HMAC_Context *ctx) {
   RESULT ret = {.exception.error = NONE};
-  RESULT sha1_ret;
-  HMAC_OPad opad;
   sha1_finish(&ctx->sctx);
   TPM_DIGEST hash = ctx->sctx.hash;
 
-  memset(opad.pad, 0x5c, HMAC_BLOCK_SIZE);
-  do_xor(opad.pad, ctx->key, opad.pad, HMAC_BLOCK_SIZE);
-
-  sha1_init(&ctx->sctx);
-  sha1_ret = sha1(&ctx->sctx, opad.pad, HMAC_BLOCK_SIZE);
-  THROW(sha1_ret.exception);
-  sha1_ret = sha1(&ctx->sctx, hash.digest, TPM_SHA1_160_HASH_LEN);
-  THROW(sha1_ret.exception);
+  sha1_resume(&ctx->sctx, &ctx->opad);
+  sha1_stream(&ctx->sctx, hash.digest, TPM_SHA1_160_HASH_LEN);
   sha1_finish(&ctx->sctx);
   return ret;
 }
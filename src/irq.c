@@ -0,0 +1,138 @@
+/*
+ * \brief   Minimal interrupt support, so that the CPU can halt while it waits
+ * for the TPM. The 8259 PICs are remapped behind the exceptions, the PIT
+ * serves as watchdog for every halt and all interrupts share one handler
+ * that only counts them.
+ */
+
+#ifndef ISABELLE
+#include "asm.h"
+#include "util.h"
+#include "irq.h"
+
+#define PIC_MASTER 0x20
+#define PIC_SLAVE 0xa0
+#define PIC_VECTOR 0x20
+#define PIC_BIOS_MASTER 0x08
+#define PIC_BIOS_SLAVE 0x70
+#define PIT_HZ 1193182
+#define PIT_MAX_US 54000
+
+struct idt_gate {
+  UINT16 offset_lo;
+  UINT16 selector;
+  BYTE zero;
+  BYTE type;
+  UINT16 offset_hi;
+};
+
+struct idt_desc {
+  UINT16 limit;
+  UINT32 base;
+};
+
+static struct idt_gate idt[PIC_VECTOR + 16];
+static struct idt_desc loader_idt;
+static BYTE loader_mask[2];
+static volatile unsigned int irq_count __attribute__((used));
+
+void irq_entry(void);
+asm(".text\n"
+    "irq_entry:\n"
+    "  pushl %eax\n"
+    "  incl irq_count\n"
+    "  movb $0x20, %al\n"
+    "  outb %al, $0xa0\n"
+    "  outb %al, $0x20\n"
+    "  popl %eax\n"
+    "  iret\n");
+
+static void pic_remap(BYTE master, BYTE slave) {
+  outb(PIC_MASTER, 0x11);
+  outb(PIC_SLAVE, 0x11);
+  outb(PIC_MASTER + 1, master);
+  outb(PIC_SLAVE + 1, slave);
+  outb(PIC_MASTER + 1, 1 << 2);
+  outb(PIC_SLAVE + 1, 2);
+  outb(PIC_MASTER + 1, 1);
+  outb(PIC_SLAVE + 1, 1);
+}
+
+/**
+ * Let counter0 of the PIT raise irq 0 once after the given microseconds.
+ */
+static void pit_oneshot(unsigned int us) {
+  if (us > PIT_MAX_US)
+    us = PIT_MAX_US;
+  unsigned int ticks = us * (PIT_HZ / 1000) / 1000 + 1;
+  outb(0x43, 0x30);
+  outb(0x40, ticks);
+  outb(0x40, ticks >> 8);
+}
+
+bool irq_init(unsigned int irq) {
+  struct idt_desc desc = {sizeof(idt) - 1, (UINT32)idt};
+  UINT16 cs;
+  unsigned i;
+
+  // irq 0 is the watchdog and irq 2 the cascade
+  if (irq == 0 || irq == 2 || irq > 15)
+    return false;
+
+  asm volatile("mov %%cs, %0" : "=r"(cs));
+  for (i = PIC_VECTOR; i < PIC_VECTOR + 16; i++)
+    idt[i] = (struct idt_gate){(UINT32)irq_entry, cs, 0, 0x8e,
+                               (UINT32)irq_entry >> 16};
+
+  // keep the exception handlers of the loader, a fault without a gate would
+  // triple fault
+  asm volatile("sidt %0" : "=m"(loader_idt));
+  unsigned int gates = (loader_idt.limit + 1) / sizeof(struct idt_gate);
+  for (i = 0; i < PIC_VECTOR && i < gates; i++)
+    idt[i] = ((struct idt_gate *)loader_idt.base)[i];
+  asm volatile("lidt %0" ::"m"(desc));
+  loader_mask[0] = inb(PIC_MASTER + 1);
+  loader_mask[1] = inb(PIC_SLAVE + 1);
+  pic_remap(PIC_VECTOR, PIC_VECTOR + 8);
+  unsigned int mask = ~(1 << 0 | 1 << 2 | 1 << irq);
+  outb(PIC_MASTER + 1, mask);
+  outb(PIC_SLAVE + 1, mask >> 8);
+
+  // check that the watchdog interrupt is delivered, before we rely on it
+  irq_count = 0;
+  pit_oneshot(1);
+  for (i = 0; i < 100000; i++) {
+    // read back the status of counter0, bit 7 is its output
+    outb(0x43, 0xe2);
+    if (inb(0x40) & 0x80)
+      break;
+  }
+  asm volatile("sti");
+  for (i = 0; i < 1000 && !irq_count; i++)
+    asm volatile("pause");
+  asm volatile("cli");
+  if (!irq_count) {
+    out_info("no interrupts, polling the TPM");
+    irq_exit();
+    return false;
+  }
+  return true;
+}
+
+void irq_wait(unsigned int us) {
+  pit_oneshot(us);
+  // sti delays interrupts by one instruction, none gets lost before the hlt
+  asm volatile("sti; hlt; cli");
+}
+
+void irq_exit(void) {
+  // counter0 runs freely again, as the BIOS and wait() expect it
+  outb(0x43, 0x34);
+  outb(0x40, 0);
+  outb(0x40, 0);
+  pic_remap(PIC_BIOS_MASTER, PIC_BIOS_SLAVE);
+  outb(PIC_MASTER + 1, loader_mask[0]);
+  outb(PIC_SLAVE + 1, loader_mask[1]);
+  asm volatile("lidt %0" ::"m"(loader_idt));
+}
+#endif
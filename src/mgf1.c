@@ -1,38 +1,62 @@
 #ifndef ISABELLE
-#include "alloc.h"
-#include "heap.h"
 #include "sha.h"
+#include "util.h"
 #include "asm.h"
+#include "mgf1.h"
 
 #define XOR_STR "XOR"
 const char *const xor_str = XOR_STR;
 const unsigned int xor_str_size =
     sizeof(XOR_STR) - 1; // don't count null-terminating character
 
-BYTE *mgf1(BYTE *input, UINT32 inputLen, UINT32 outputLen) {
-
+/*
+ * The input is hashed only once, each 20-byte block of the mask continues
+ * from a copy of that state with its big-endian counter. The leading counter
+ * bytes that are zero for every block belong to the shared prefix, so a
+ * 63-byte TPM_Sealx seed fills a whole block that is compressed only once.
+ */
+static void mgf1_blocks(const BYTE *input, UINT32 inputLen, BYTE *output,
+                        UINT32 outputLen, bool xor) {
+  SHA1_Context prefix, sctx;
   UINT32 counter = 0;
-  UINT32 outputLenRoundedUp;
-  if (outputLen % 20 != 0) {
-    outputLenRoundedUp = outputLen + (20 - (outputLen % 20));
-  } else {
-    outputLenRoundedUp = outputLen;
-  }
+  UINT32 last = outputLen ? (outputLen - 1) / sizeof(TPM_DIGEST) : 0;
+  UINT32 res = 0;
+  unsigned fixed = 0;
 
-  SHA1_Context sctx;
-  TPM_DIGEST *output = alloc(heap, outputLenRoundedUp);
+  while (fixed < 3 && !(last >> (24 - 8 * fixed)))
+    fixed++;
 
-  while ((counter * 20) < outputLen) {
+  sha1_init(&prefix);
+  sha1_stream(&prefix, input, inputLen);
+  sha1_stream(&prefix, &res, fixed);
 
-    int res = htonl(counter);
-    sha1_init(&sctx);
-    sha1(&sctx, (BYTE *)input, inputLen);
-    sha1(&sctx, (BYTE *)&res, sizeof(res));
+  while (outputLen) {
+    UINT32 n = outputLen < sizeof(TPM_DIGEST) ? outputLen : sizeof(TPM_DIGEST);
+
+    res = htonl(counter);
+    sctx = prefix;
+    sha1_stream(&sctx, (BYTE *)&res + fixed, sizeof(res) - fixed);
     sha1_finish(&sctx);
-    output[counter] = sctx.hash;
+    if (xor)
+      do_xor(output, sctx.hash.digest, output, n);
+    else
+      memcpy(output, sctx.hash.digest, n);
+    output += n;
+    outputLen -= n;
     counter++;
   }
 
-  return (BYTE *)output;
+  memset(&prefix, 0, sizeof(prefix));
+  memset(&sctx, 0, sizeof(sctx));
+}
+
+void mgf1(const BYTE *input, UINT32 inputLen, BYTE *output,
+          UINT32 outputLen) {
+  mgf1_blocks(input, inputLen, output, outputLen, false);
+}
+
+void mgf1_xor(const BYTE *input, UINT32 inputLen, BYTE *data,
+              UINT32 dataLen) {
+  mgf1_blocks(input, inputLen, data, dataLen, true);
 }
 #endif
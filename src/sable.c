@@ -28,6 +28,8 @@
 #include "util.h"
 #include "version.h"
 #include "mgf1.h"
+#include "sha256.h"
+#include "event_log.h"
 #endif
 #ifdef __ARCH_AMD__
 #include "amd.h"
@@ -45,6 +47,9 @@ BYTE heap_array[8 * KB] __attribute__((aligned(8)));
 BYTE *heap = heap_array;
 
 #define PASSPHRASE_STR_SIZE 128
+#define MBI_HASH_BATCH 4
+#define MBI_HASH_STRIDE (16 * KB)
+#define EXTEND_QUEUE 8
 #define AUTHDATA_STR_SIZE 64
 
 #ifdef __ARCH_INTEL__
@@ -61,12 +66,13 @@ int txt_launch_environment();
 // void print_mbi(struct mbi *mbi);
 
 // Result generators
-RESULT_GEN(TPM_NONCE);
 RESULT_GEN(TPM_AUTHDATA);
 
 RESULT_(TPM_AUTHDATA) get_authdata(void);
 RESULT_(TPM_NONCE) get_nonce(void);
 
+// sessions[0] is an OSAP session for one command, sessions[1] is the OIAP
+// session of tpm_session_oiap(), which the TPM closes with its command
 static TPM_SESSION *sessions[2] = {NULL, NULL};
 
 #ifndef ISABELLE
@@ -99,19 +105,57 @@ RESULT_(TPM_AUTHDATA) get_authdata(void) {
   return ret;
 }
 
+/*
+ * TPM randomness for the nonces. It is fetched with one command that fills
+ * most of the TIS buffer, and fetched again when it runs out. The pool is
+ * taken from the heap, as the SLB has no room left for it.
+ */
+#define NONCE_POOL_SIZE                                                        \
+  ((TIS_BUFFER_SIZE - 14) / sizeof(TPM_NONCE) * sizeof(TPM_NONCE))
+static struct {
+  BYTE *bytes;
+  UINT32 left;
+} nonce_pool;
+
 /* Except:
+ * ERROR_BUFFER_OVERFLOW
  * ERROR_TPM
  * ERROR_TPM_BAD_OUTPUT_PARAM
  * temporary solution, in the long term we should not rely on the TPM to
  * generate nonces. */
 RESULT_(TPM_NONCE) get_nonce(void) {
   RESULT_(TPM_NONCE) ret = {.exception.error = NONE};
-  RESULT get_random_res;
-  get_random_res = TPM_GetRandom(ret.value.nonce, sizeof(TPM_NONCE));
-  THROW(get_random_res.exception);
+  if (nonce_pool.left < sizeof(TPM_NONCE)) {
+    if (!nonce_pool.bytes)
+      nonce_pool.bytes = alloc(heap, NONCE_POOL_SIZE);
+    ERROR(!nonce_pool.bytes, ERROR_BUFFER_OVERFLOW, "no heap for the nonces");
+    UINT32 received;
+    RESULT get_random_res =
+        TPM_GetRandom(nonce_pool.bytes, NONCE_POOL_SIZE, &received);
+    THROW(get_random_res.exception);
+    nonce_pool.left = received;
+    ERROR(nonce_pool.left < sizeof(TPM_NONCE), ERROR_TPM_BAD_OUTPUT_PARAM,
+          "Not enough random bytes for a nonce");
+  }
+  // hand out every nonce only once
+  nonce_pool.left -= sizeof(TPM_NONCE);
+  memcpy(ret.value.nonce, nonce_pool.bytes + nonce_pool.left,
+         sizeof(TPM_NONCE));
+  memset(nonce_pool.bytes + nonce_pool.left, 0, sizeof(TPM_NONCE));
   return ret;
 }
 
+/*
+ * Wipe the unused nonces, and the copy of them in the TIS response buffer,
+ * before another program gets the machine.
+ */
+static void wipe_nonce_pool(void) {
+  if (nonce_pool.bytes)
+    memset(nonce_pool.bytes, 0, NONCE_POOL_SIZE);
+  nonce_pool.left = 0;
+  memset(&tis_buffers, 0, sizeof(tis_buffers));
+}
+
 RESULT_GEN(TPM_PCR_INFO_LONG);
 
 // Construct pcr_info, which contains the TPM state conditions under which
@@ -131,16 +175,16 @@ static RESULT_(TPM_PCR_INFO_LONG) get_pcr_info(void) {
   TPM_PCR_SELECTION pcr_select = {.sizeOfSelect = 3,
                                   .pcrSelect = (BYTE *)pcr_select_bytes};
 #ifdef __ARCH_AMD__
-  RESULT_(TPM_PCRVALUE) pcr17 = TPM_PCRRead(17);
+  RESULT_(TPM_PCRVALUE) pcr17 = tpm_pcr_read(17);
   THROW(pcr17.exception);
   pcr_values[0] = pcr17.value;
 #endif
 #ifdef __ARCH_INTEL__
-  RESULT_(TPM_PCRVALUE) pcr18 = TPM_PCRRead(18);
+  RESULT_(TPM_PCRVALUE) pcr18 = tpm_pcr_read(18);
   THROW(pcr18.exception);
   pcr_values[0] = pcr18.value;
 #endif
-  RESULT_(TPM_PCRVALUE) pcr19 = TPM_PCRRead(19);
+  RESULT_(TPM_PCRVALUE) pcr19 = tpm_pcr_read(19);
   THROW(pcr19.exception);
   pcr_values[1] = pcr19.value;
   TPM_PCR_COMPOSITE composite = {.select = pcr_select,
@@ -195,9 +239,9 @@ static RESULT_(TPM_STORED_DATA12)
   memcpy(seed + sizeof(TPM_NONCE) + sizeof(TPM_NONCE), "XOR", 3);
   memcpy(seed + sizeof(TPM_NONCE) + sizeof(TPM_NONCE) + 3, &sharedSecret,
          sizeof(TPM_SECRET));
-  const BYTE *mask = mgf1(seed, seedLen, lenPassphrase);
   BYTE *passEnc = alloc(heap, lenPassphrase);
-  do_xor((const BYTE *)passphrase, mask, passEnc, lenPassphrase);
+  memcpy(passEnc, passphrase, lenPassphrase);
+  mgf1_xor(seed, seedLen, passEnc, lenPassphrase);
 
   // Encrypt the passphrase using the SRK
   return TPM_Sealx(TPM_KH_SRK, encAuth, pcr_info.value, passEnc, lenPassphrase,
@@ -212,16 +256,18 @@ static RESULT write_passphrase(TPM_AUTHDATA nv_auth,
                                TPM_STORED_DATA12 sealedData, UINT32 index,
                                UINT32 size) {
   RESULT ret = {.exception.error = NONE};
+  struct extracted_TPM_STORED_DATA12 x = extract_TPM_STORED_DATA12(sealedData);
+  ERROR(x.dataSize > size, ERROR_BUFFER_OVERFLOW,
+        "The sealed passphrase does not fit into the NV space");
 
-  RESULT oiap_ret = TPM_OIAP(&sessions[0]);
-  THROW(oiap_ret.exception);
+  // the last command of the configuration, let the TPM close the session
   RESULT_(TPM_NONCE) nonceOdd = get_nonce();
   THROW(nonceOdd.exception);
-  sessions[0]->nonceOdd = nonceOdd.value;
-  sessions[0]->continueAuthSession = FALSE;
+  RESULT oiap_ret = tpm_session_oiap(&sessions[1], nonceOdd.value);
+  THROW(oiap_ret.exception);
 
-  struct extracted_TPM_STORED_DATA12 x = extract_TPM_STORED_DATA12(sealedData);
-  return TPM_NV_WriteValueAuth(x.data, size, index, 0, nv_auth, &sessions[0]);
+  return tpm_nv_write(x.data, x.dataSize, index, nv_auth, &sessions[1],
+                      get_nonce);
 }
 
 RESULT configure(UINT32 index, UINT32 size) {
@@ -258,16 +304,20 @@ RESULT configure(UINT32 index, UINT32 size) {
 }
 #endif
 
-static RESULT_(TPM_STORED_DATA12) read_passphrase(UINT32 index, UINT32 size) {
-  const OPTION(TPM_AUTHDATA) nv_auth = {.hasValue = false};
+/* The sealed passphrase may only be valid until the next TPM command */
+static RESULT_(DATA_VIEW) read_passphrase(UINT32 index, UINT32 size) {
   // EXCLUDE(out_string("Please enter the size of nvRegion : ");)
   // UINT32 nv_region = asc_to_uint();
-  RESULT_(HEAP_DATA) val = TPM_NV_ReadValue(index, 0, size, nv_auth, NULL);
-  THROW_TYPE(RESULT_(TPM_STORED_DATA12), val.exception);
+  RESULT_(DATA_VIEW) ret = tpm_nv_read(index, size);
+  THROW(ret.exception);
+
+  // the NV space may be larger than the TPM_STORED_DATA12 it holds
+  ret.value.dataSize =
+      check_TPM_STORED_DATA12(ret.value.data, ret.value.dataSize);
+  ERROR(ret.value.dataSize == 0, ERROR_TPM_BAD_OUTPUT_PARAM,
+        "No sealed passphrase in the NV space");
 
-  return (RESULT_(TPM_STORED_DATA12)){
-      .exception.error = NONE,
-      .value = unpack_TPM_STORED_DATA12(val.value.data, val.value.dataSize)};
+  return ret;
 }
 
 typedef const char *CSTRING;
@@ -275,7 +325,7 @@ RESULT_GEN(CSTRING);
 
 static RESULT_(CSTRING)
     unseal_passphrase(TPM_AUTHDATA srk_auth, TPM_AUTHDATA pp_auth,
-                      TPM_STORED_DATA12 sealed_pp) {
+                      UINT32 index, UINT32 size) {
   RESULT_(CSTRING) ret = {.exception.error = NONE};
 
   RESULT_(TPM_NONCE) nonceOdd = get_nonce();
@@ -287,12 +337,10 @@ static RESULT_(CSTRING)
       sharedSecret_gen(srk_auth, sessions[0]->osap->nonceEvenOSAP,
                        sessions[0]->osap->nonceOddOSAP);
 
-  RESULT pp_oiap_ret = TPM_OIAP(&sessions[1]);
-  THROW(pp_oiap_ret.exception);
   nonceOdd = get_nonce();
   THROW(nonceOdd.exception);
-  sessions[1]->nonceOdd = nonceOdd.value;
-  sessions[1]->continueAuthSession = FALSE;
+  RESULT pp_oiap_ret = tpm_session_oiap(&sessions[1], nonceOdd.value);
+  THROW(pp_oiap_ret.exception);
 
 #ifdef USE_TPM_SEALX
   const UINT32 seedLen =
@@ -305,33 +353,27 @@ static RESULT_(CSTRING)
   marshal_array(xor_str, xor_str_size, pctx, NULL);
   marshal_TPM_SECRET(sharedSecret, pctx, NULL);
   pack_finish(pctx);
+#endif
 
+  // no other TPM command between them, TPM_Unseal sends the sealed passphrase
+  // straight from the response of TPM_NV_ReadValue
+  RESULT_(DATA_VIEW) sealed_pp = read_passphrase(index, size);
+  THROW(sealed_pp.exception);
   RESULT_(HEAP_DATA)
-  unseal_ret = TPM_Unseal(sealed_pp, TPM_KH_SRK, sharedSecret, &sessions[0],
-                          pp_auth, &sessions[1]);
-  THROW(unseal_ret.exception);
-
-  const BYTE *mask = mgf1(seed, seedLen, unseal_ret.value.dataSize);
-  BYTE *passUnc = alloc(heap, unseal_ret.value.dataSize);
-  do_xor(unseal_ret.value.data, mask, passUnc, unseal_ret.value.dataSize);
-
-  ret.value = (CSTRING)passUnc;
-#else
-  RESULT_(HEAP_DATA)
-  unseal_ret = TPM_Unseal(sealed_pp, TPM_KH_SRK, sharedSecret, &sessions[0],
-                          pp_auth, &sessions[1]);
+  unseal_ret = TPM_Unseal(sealed_pp.value, TPM_KH_SRK, sharedSecret,
+                          &sessions[0], pp_auth, &sessions[1]);
   THROW(unseal_ret.exception);
 
-  ret.value = (CSTRING)unseal_ret.value.data;
+#ifdef USE_TPM_SEALX
+  mgf1_xor(seed, seedLen, unseal_ret.value.data, unseal_ret.value.dataSize);
 #endif
+  ret.value = (CSTRING)unseal_ret.value.data;
 
   return ret;
 }
 
 RESULT trusted_boot(UINT32 index, UINT32 size) {
   RESULT ret = {.exception.error = NONE};
-  RESULT_(TPM_STORED_DATA12) sealed_pp = read_passphrase(index, size);
-  THROW(sealed_pp.exception);
 
   EXCLUDE(out_string("Please enter the passPhraseAuthData (" xstr(
       AUTHDATA_STR_SIZE) " char max): ");)
@@ -343,8 +385,7 @@ RESULT trusted_boot(UINT32 index, UINT32 size) {
   THROW(srk_auth.exception);
 
   RESULT_(CSTRING)
-  passphrase =
-      unseal_passphrase(srk_auth.value, pp_auth.value, sealed_pp.value);
+  passphrase = unseal_passphrase(srk_auth.value, pp_auth.value, index, size);
   THROW(passphrase.exception);
 
   EXCLUDE(out_string("Please confirm that the passphrase is correct:\n\n");)
@@ -353,15 +394,165 @@ RESULT trusted_boot(UINT32 index, UINT32 size) {
       out_string("\n\nIf this is correct, please type YES in all capitals: ");)
 
   EXCLUDE(char *yes_string = alloc(heap, 4); get_string(yes_string, 4, true);
-          if (memcmp("YES", yes_string, 3)) reboot();)
+          if (memcmp("YES", yes_string, 3)) {
+            wipe_nonce_pool();
+            reboot();
+          })
 
   return ret;
 }
 
 #ifndef ISABELLE
+#ifdef MEASURE_SHA256
+/*
+ * The TPM 1.2 has no SHA-256 PCR bank, so the SHA-256 measurements are only
+ * shown next to the extended SHA-1 ones.
+ */
+static void show_sha256(const char *s, const void *data, UINT32 count) {
+  SHA256_Context ctx;
+
+  sha256_init(&ctx);
+  sha256_stream(&ctx, data, count);
+  sha256_finish(&ctx);
+  show_hash_bytes(s, ctx.hash.digest, SHA256_HASH_LEN);
+}
+#endif
+
+/*
+ * The measurements wait here for PCR 19, so that the TPM extends one while
+ * the CPU hashes the next modules. They are extended in queue order.
+ */
+static struct {
+  TPM_DIGEST digest[EXTEND_QUEUE];
+  unsigned head, tail;
+  bool busy;
+} extend_queue;
+
+/* EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ *
+ * Complete the extend in flight if the TPM is done with it, or wait for it
+ * if wait is set, and submit the next queued one.
+ */
+static RESULT extend_pump(bool wait) {
+  RESULT ret = {.exception.error = NONE};
+
+  if (extend_queue.busy) {
+    if (!wait && !tis_poll())
+      return ret;
+    RESULT_(TPM_PCRVALUE) extend_ret = TPM_Extend_complete();
+    THROW(extend_ret.exception);
+    extend_queue.busy = false;
+  }
+  if (extend_queue.head != extend_queue.tail) {
+    RESULT submit_ret = TPM_Extend_submit(
+        19, extend_queue.digest[extend_queue.head++ % EXTEND_QUEUE]);
+    THROW(submit_ret.exception);
+    extend_queue.busy = true;
+  }
+  return ret;
+}
+
+/* EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ *
+ * Queue an extend of PCR 19, the queue is only waited for when it is full.
+ */
+static RESULT extend_later(TPM_DIGEST digest) {
+  RESULT ret = {.exception.error = NONE};
+
+  while (extend_queue.tail - extend_queue.head == EXTEND_QUEUE) {
+    RESULT pump_ret = extend_pump(true);
+    THROW(pump_ret.exception);
+  }
+  extend_queue.digest[extend_queue.tail++ % EXTEND_QUEUE] = digest;
+  RESULT pump_ret = extend_pump(false);
+  THROW(pump_ret.exception);
+  return ret;
+}
+
+#ifdef EVENT_LOG_AGGREGATE
+/* the digest over all logged measurements, which is extended instead */
+static SHA1_Context aggregate;
+#endif
+
+/* EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ *
+ * Record a measurement of the given string or of what it describes in the
+ * event log, if there is one, and queue its extend of PCR 19. With
+ * EVENT_LOG_AGGREGATE it is only logged and folded into the aggregate digest.
+ */
+static RESULT measure(TPM_DIGEST digest, const char *description) {
+  RESULT ret = {.exception.error = NONE};
+
+#ifdef EVENT_LOG_AGGREGATE
+  event_log_add(19, EV_NO_ACTION, digest, description, strlen(description));
+  sha1_stream(&aggregate, digest.digest, sizeof(digest.digest));
+#else
+#ifdef EVENT_LOG
+  event_log_add(19, EV_IPL, digest, description, strlen(description));
+#else
+  UNUSED(description);
+#endif
+  ret = extend_later(digest);
+#endif
+  return ret;
+}
+
+/* EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ *
+ * Hash a batch of modules stride by stride, so that every stride is still
+ * cached when it is hashed with SHA-256 and, if load is set, when the first
+ * module of the batch is copied to its load addresses. Each module is read
+ * from memory only once. Between the strides the queued extends are fed to
+ * the TPM.
+ */
+static RESULT mbi_hash_batch(SHA1_Job *jobs, SHA256_Context *ctx256,
+                             unsigned n, bool load) {
+  RESULT ret = {.exception.error = NONE};
+  SHA1_Job stride[MBI_HASH_BATCH];
+  const BYTE *load_data;
+  UINT32 left;
+
+  do {
+    left = 0;
+    load_data = jobs[0].data;
+    for (unsigned j = 0; j < n; j++) {
+      stride[j] = jobs[j];
+      if (stride[j].count > MBI_HASH_STRIDE)
+        stride[j].count = MBI_HASH_STRIDE;
+#ifdef MEASURE_SHA256
+      sha256_stream(ctx256 + j, stride[j].data, stride[j].count);
+#endif
+      jobs[j].data += stride[j].count;
+      jobs[j].count -= stride[j].count;
+      left |= jobs[j].count;
+    }
+    sha1_multi(stride, n);
+    // sha1_multi() consumes the strides, jobs[0] already points behind it
+    if (load)
+      load_module_stride(load_data, jobs[0].data - load_data);
+    RESULT pump_ret = extend_pump(false);
+    THROW(pump_ret.exception);
+  } while (left);
+
+  return ret;
+}
+
 /* EXCEPT:
  * ERROR_BAD_MODULE
  * ERROR_NO_MODULE
+ * ERROR_TIS_TRANSMIT
  * ERROR_TPM
  * ERROR_TPM_BAD_OUTPUT_PARAM
  *
@@ -369,17 +560,28 @@ RESULT trusted_boot(UINT32 index, UINT32 size) {
  */
 static RESULT mbi_calc_hash(struct mbi *mbi) {
   RESULT ret = {.exception.error = NONE};
-  RESULT_(TPM_PCRVALUE) extend_ret;
-  RESULT sha1_ret;
+  RESULT extend_ret;
   SHA1_Context sctx;
 
+#ifdef EVENT_LOG
+  if (!event_log_init())
+    out_info("No TCG event log, measurements are not logged");
+#endif
+#ifdef EVENT_LOG_AGGREGATE
+  sha1_init(&aggregate);
+#endif
+
   // hash SABLE's command line
   if (CHECK_FLAG(mbi->flags, MBI_FLAG_CMDLINE)) {
     sha1_init(&sctx);
-    sha1(&sctx, (BYTE *)mbi->cmdline, strLen((char *)mbi->cmdline));
+    sha1_stream(&sctx, (BYTE *)mbi->cmdline, strLen((char *)mbi->cmdline));
     sha1_finish(&sctx);
-    extend_ret = TPM_Extend(19, sctx.hash);
+    extend_ret = measure(sctx.hash, (char *)mbi->cmdline);
     THROW(extend_ret.exception);
+#ifdef MEASURE_SHA256
+    show_sha256("SHA-256 cmdline: ", (BYTE *)mbi->cmdline,
+                strLen((char *)mbi->cmdline));
+#endif
   }
 
   ERROR(!CHECK_FLAG(mbi->flags, MBI_FLAG_MODS), ERROR_BAD_MODULE,
@@ -389,35 +591,82 @@ static RESULT mbi_calc_hash(struct mbi *mbi) {
 
   out_description("Hashing modules count", mbi->mods_count);
 
+  // the first module is started later, load it while it is hashed
+  load_module_prepare(mbi);
+
+  // hash the modules in batches, but extend in the original order
   struct module *m = (struct module *)(mbi->mods_addr);
-  for (unsigned i = 0; i < mbi->mods_count; i++, m++) {
-    sha1_init(&sctx);
+  for (unsigned i = 0; i < mbi->mods_count; i += MBI_HASH_BATCH) {
+    SHA1_Context mctx[MBI_HASH_BATCH];
+    SHA1_Job jobs[MBI_HASH_BATCH];
+#ifdef MEASURE_SHA256
+    SHA256_Context mctx256[MBI_HASH_BATCH];
+#endif
+    unsigned n = mbi->mods_count - i < MBI_HASH_BATCH ? mbi->mods_count - i
+                                                      : MBI_HASH_BATCH;
 
-    ERROR(m->mod_end < m->mod_start, ERROR_BAD_MODULE,
-          "mod_end less than start");
+    for (unsigned j = 0; j < n; j++) {
+      ERROR(m[i + j].mod_end < m[i + j].mod_start, ERROR_BAD_MODULE,
+            "mod_end less than start");
 #ifndef NDEBUG
-    out_description("Module", i);
-    out_description("Address", m->mod_start);
-    out_description("Size", m->mod_end - m->mod_start);
+      out_description("Module", i + j);
+      out_description("Address", m[i + j].mod_start);
+      out_description("Size", m[i + j].mod_end - m[i + j].mod_start);
+#endif
+      sha1_init(mctx + j);
+      jobs[j] = (SHA1_Job){.data = (BYTE *)m[i + j].mod_start,
+                           .count = m[i + j].mod_end - m[i + j].mod_start,
+                           .ctx = mctx + j};
+#ifdef MEASURE_SHA256
+      sha256_init(mctx256 + j);
+#endif
+    }
+#ifdef MEASURE_SHA256
+    extend_ret = mbi_hash_batch(jobs, mctx256, n, i == 0);
+#else
+    extend_ret = mbi_hash_batch(jobs, NULL, n, i == 0);
 #endif
-
-    sha1_ret = sha1(&sctx, (BYTE *)m->mod_start, m->mod_end - m->mod_start);
-    THROW(sha1_ret.exception);
-    sha1_finish(&sctx);
-    extend_ret = TPM_Extend(19, sctx.hash);
     THROW(extend_ret.exception);
 
-    if (strlen((char *)m->string) > 0) {
-      sha1_init(&sctx);
-      // hash the command-line arguments for this module
-      sha1(&sctx, (unsigned char *)m->string, strlen((char *)m->string));
-      THROW(sha1_ret.exception);
-      sha1_finish(&sctx);
-      extend_ret = TPM_Extend(19, sctx.hash);
+    for (unsigned j = 0; j < n; j++) {
+      sha1_finish(mctx + j);
+      extend_ret = measure(mctx[j].hash, (char *)m[i + j].string);
       THROW(extend_ret.exception);
+#ifdef MEASURE_SHA256
+      sha256_finish(mctx256 + j);
+      show_hash_bytes("SHA-256 module: ", mctx256[j].hash.digest,
+                      SHA256_HASH_LEN);
+#endif
+
+      if (strlen((char *)m[i + j].string) > 0) {
+        sha1_init(&sctx);
+        // hash the command-line arguments for this module
+        sha1_stream(&sctx, (unsigned char *)m[i + j].string,
+                    strlen((char *)m[i + j].string));
+        sha1_finish(&sctx);
+        extend_ret = measure(sctx.hash, (char *)m[i + j].string);
+        THROW(extend_ret.exception);
+#ifdef MEASURE_SHA256
+        show_sha256("SHA-256 module string: ", (BYTE *)m[i + j].string,
+                    strlen((char *)m[i + j].string));
+#endif
+      }
     }
   }
 
+#ifdef EVENT_LOG_AGGREGATE
+  sha1_finish(&aggregate);
+  event_log_add(19, EV_COMPACT_HASH, aggregate.hash, "SABLE", 5);
+  extend_ret = extend_later(aggregate.hash);
+  THROW(extend_ret.exception);
+#endif
+
+  // the PCRs are read next, wait for the last extends
+  while (extend_queue.busy) {
+    extend_ret = extend_pump(true);
+    THROW(extend_ret.exception);
+  }
+
   return ret;
 }
 
@@ -445,6 +694,24 @@ static RESULT prepare_tpm(void) {
         out_info("TPM already initialized"));
   THROW(tpm_startup_ret.exception);
 
+  // poll within the bounds of this TPM instead of the TIS spec defaults
+  UINT32 timeouts[4];
+  RESULT cap_ret = TPM_GetCapability(TPM_CAP_PROPERTY, TPM_CAP_PROP_TIS_TIMEOUT,
+                                     timeouts, 4);
+  if (!cap_ret.exception.error)
+    tis_set_timeouts(TIS_TIMEOUT_A, timeouts, 4);
+  CATCH_ANY(cap_ret.exception, out_info("TIS timeouts not reported"));
+  cap_ret = TPM_GetCapability(TPM_CAP_PROPERTY, TPM_CAP_PROP_DURATION,
+                              timeouts, 3);
+  if (!cap_ret.exception.error)
+    tis_set_timeouts(TIS_DURATION_SHORT, timeouts, 3);
+  CATCH_ANY(cap_ret.exception, out_info("TPM durations not reported"));
+
+  // the self-test runs while the CPU prepares the late launch, the first
+  // command after it waits for the rest
+  RESULT selftest_ret = TPM_ContinueSelfTest_submit();
+  THROW(selftest_ret.exception);
+
   RESULT tis_deactivate_res = tis_deactivate_all();
   THROW(tis_deactivate_res.exception);
 
@@ -549,7 +816,19 @@ void _pre_launch(struct mbi *m, unsigned flags) {
  */
 RESULT post_launch(struct mbi *m) {
   RESULT ret = {.exception.error = NONE};
+  // nothing that was left in .bss before the late launch may be trusted
+  tpm_cache_reset();
+  memset(&extend_queue, 0, sizeof(extend_queue));
   init_heap(heap, sizeof(heap_array));
+  // outside of the scopes below, the nonces are used until the end, what
+  // .bss held before the late launch is not a count of them
+  nonce_pool.bytes = alloc(heap, NONCE_POOL_SIZE);
+  nonce_pool.left = 0;
+#ifdef TIS_TRACE
+  tis_trace_start(alloc(heap, TIS_TRACE_RECORDS *
+                                  sizeof(struct tis_trace_record)),
+                  TIS_TRACE_RECORDS);
+#endif
 #ifdef __ARCH_INTEL__
   copy_e820_map(g_ldr_ctx);
   intel_post_launch();
@@ -595,22 +874,34 @@ RESULT post_launch(struct mbi *m) {
     out_info("Calculating hash");
 #endif
 
+#ifdef SHA1_SIMD
+    sha1_simd_begin();
+#ifdef MEASURE_SHA256
+    sha256_simd_begin();
+#endif
+#endif
     RESULT mbi_calc_hash_ret = mbi_calc_hash(m);
+#ifdef SHA1_SIMD
+#ifdef MEASURE_SHA256
+    sha256_simd_end();
+#endif
+    sha1_simd_end();
+#endif
     THROW(mbi_calc_hash_ret.exception);
 
 #ifdef __ARCH_AMD__
-    RESULT_(TPM_PCRVALUE) pcr17 = TPM_PCRRead(17);
+    RESULT_(TPM_PCRVALUE) pcr17 = tpm_pcr_read(17);
     THROW(pcr17.exception);
     show_hash("PCR[17]: ", pcr17.value);
 #endif
 
 #ifdef __ARCH_INTEL__
-    RESULT_(TPM_PCRVALUE) pcr18 = TPM_PCRRead(18);
+    RESULT_(TPM_PCRVALUE) pcr18 = tpm_pcr_read(18);
     THROW(pcr18.exception);
     show_hash("PCR[18]: ", pcr18.value);
 #endif
 
-    RESULT_(TPM_PCRVALUE) pcr19 = TPM_PCRRead(19);
+    RESULT_(TPM_PCRVALUE) pcr19 = tpm_pcr_read(19);
     THROW(pcr19.exception);
     show_hash("PCR[19]: ", pcr19.value);
 
@@ -619,11 +910,16 @@ RESULT post_launch(struct mbi *m) {
     char config_str[2];
     out_string("Configure now? [y/n]: ");
     get_string(config_str, sizeof(config_str) - 1, true);
+    // the sessions, the sealed and the unsealed passphrase are freed once the
+    // TPM closed the sessions, the exceptions of a failure are kept
+    UINT32 scope = heap_mark();
     if (config_str[0] == 'y') {
       RESULT configure_ret = configure(nvIndex, nvSize);
       THROW(configure_ret.exception);
+      heap_release(heap, scope);
       RESULT tis_deactiv = tis_deactivate_all();
       THROW(tis_deactiv.exception);
+      wipe_nonce_pool();
       out_string("\nConfiguration complete. Rebooting now...\n");
       wait(5000);
       reboot();
@@ -635,12 +931,18 @@ RESULT post_launch(struct mbi *m) {
     } else {
       RESULT trusted_boot_ret = trusted_boot(nvIndex, nvSize);
       THROW(trusted_boot_ret.exception);
+      heap_release(heap, scope);
 
       RESULT tis_deactiv = tis_deactivate_all();
       THROW(tis_deactiv.exception);
     }
   }
 
+  wipe_nonce_pool();
+#ifdef TIS_TRACE
+  tis_trace_dump();
+#endif
+
 #ifdef __ARCH_INTEL__
   out_string("Launching Linux Kernel now..");
   launch_kernel(true);
@@ -655,6 +957,7 @@ RESULT post_launch(struct mbi *m) {
 void _post_launch(struct mbi *m) {
   RESULT res = post_launch(m);
   CATCH_ANY(res.exception, {
+    wipe_nonce_pool();
     dump_exception(res.exception);
     exit(res.exception.error);
   });
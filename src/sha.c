@@ -1,5 +1,9 @@
 /*
- * \brief   A size optimized SHA1 variant, hashes up to 512MB.
+ * \brief   A SHA1 implementation.
+ * Defining SHA1_UNROLLED selects a speed optimized compression function
+ * instead of the size optimized default, SHA1_SIMD adds a SHA-NI block
+ * function and a vector one, compiled for SSE2, SSSE3 and AVX2, that are used
+ * between sha1_simd_begin() and sha1_simd_end().
  * \date    2006-03-28
  * \author  Bernhard Kauer <kauer@tudos.org>
  */
@@ -20,6 +24,87 @@
 
 #define ROL(VALUE, COUNT) ((VALUE) << COUNT | (VALUE) >> (32 - COUNT))
 
+#define F1(B, C, D) ((D) ^ ((B) & ((C) ^ (D))))
+#define F2(B, C, D) ((B) ^ (C) ^ (D))
+#define F3(B, C, D) (((B) & (C)) | ((D) & ((B) | (C))))
+
+#define ROUND(A, B, C, D, E, F, K, W)                                          \
+  {                                                                            \
+    E += ROL(A, 5) + F(B, C, D) + K + W;                                       \
+    B = ROL(B, 30);                                                            \
+  }
+
+/* five rounds rotate the variable names back into place */
+#define ROUND5(F, K, W, t)                                                     \
+  {                                                                            \
+    ROUND(a, b, c, d, e, F, K, W(t));                                          \
+    ROUND(e, a, b, c, d, F, K, W(t + 1));                                      \
+    ROUND(d, e, a, b, c, F, K, W(t + 2));                                      \
+    ROUND(c, d, e, a, b, F, K, W(t + 3));                                      \
+    ROUND(b, c, d, e, a, F, K, W(t + 4));                                      \
+  }
+
+/* SHA1_Context is packed, the words of its digest may be at any address */
+typedef unsigned int u32_unaligned __attribute__((aligned(1)));
+
+#ifdef SHA1_UNROLLED
+/*
+ * The message schedule lives in a circular window of 16 words: w[t & 15] is
+ * overwritten with W(t) once W(t - 16) has been consumed.
+ */
+#define LOAD(t) (w[t] = ntohl(((const unsigned int *)data)[t]))
+#define EXPAND(t)                                                              \
+  (w[(t)&15] = ROL(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] ^                    \
+                       w[((t) + 2) & 15] ^ w[(t)&15],                          \
+                   1))
+
+/**
+ * Process a single block of 512 bits.
+ *
+ * Speed optimized variant: all 80 rounds are unrolled and the working
+ * variables are kept in locals, so no array is shifted or rotated per round.
+ */
+static void process_block(SHA1_Context *ctx, const BYTE *data) {
+  u32_unaligned *h = (u32_unaligned *)ctx->hash.digest;
+  unsigned int w[16];
+  unsigned int a = ntohl(h[0]);
+  unsigned int b = ntohl(h[1]);
+  unsigned int c = ntohl(h[2]);
+  unsigned int d = ntohl(h[3]);
+  unsigned int e = ntohl(h[4]);
+
+  ROUND5(F1, 0x5A827999, LOAD, 0);
+  ROUND5(F1, 0x5A827999, LOAD, 5);
+  ROUND5(F1, 0x5A827999, LOAD, 10);
+  ROUND(a, b, c, d, e, F1, 0x5A827999, LOAD(15));
+  ROUND(e, a, b, c, d, F1, 0x5A827999, EXPAND(16));
+  ROUND(d, e, a, b, c, F1, 0x5A827999, EXPAND(17));
+  ROUND(c, d, e, a, b, F1, 0x5A827999, EXPAND(18));
+  ROUND(b, c, d, e, a, F1, 0x5A827999, EXPAND(19));
+
+  ROUND5(F2, 0x6ED9EBA1, EXPAND, 20);
+  ROUND5(F2, 0x6ED9EBA1, EXPAND, 25);
+  ROUND5(F2, 0x6ED9EBA1, EXPAND, 30);
+  ROUND5(F2, 0x6ED9EBA1, EXPAND, 35);
+
+  ROUND5(F3, 0x8F1BBCDC, EXPAND, 40);
+  ROUND5(F3, 0x8F1BBCDC, EXPAND, 45);
+  ROUND5(F3, 0x8F1BBCDC, EXPAND, 50);
+  ROUND5(F3, 0x8F1BBCDC, EXPAND, 55);
+
+  ROUND5(F2, 0xCA62C1D6, EXPAND, 60);
+  ROUND5(F2, 0xCA62C1D6, EXPAND, 65);
+  ROUND5(F2, 0xCA62C1D6, EXPAND, 70);
+  ROUND5(F2, 0xCA62C1D6, EXPAND, 75);
+
+  /* we store the hash in big endian - this avoids a loop at the end... */
+  h[0] = htonl(ntohl(h[0]) + a);
+  h[1] = htonl(ntohl(h[1]) + b);
+  h[2] = htonl(ntohl(h[2]) + c);
+  h[3] = htonl(ntohl(h[3]) + d);
+  h[4] = htonl(ntohl(h[4]) + e);
+}
+#else
 /*
  * Get a w value.
  *
@@ -43,11 +128,14 @@ inline static unsigned int get_w(unsigned char *value, unsigned int round) {
 /**
  * Process a single block of 512 bits.
  */
-static void process_block(SHA1_Context *ctx) {
+static void process_block(SHA1_Context *ctx, const BYTE *data) {
   unsigned int i;
   unsigned int X[6];
   unsigned int tmp;
 
+  if (data != ctx->buffer)
+    memcpy(ctx->buffer, data, 64);
+
   for (i = 0; i < 5; i++)
     X[i + 1] = ntohl(((unsigned int *)ctx->hash.digest)[i]);
 
@@ -74,6 +162,406 @@ static void process_block(SHA1_Context *ctx) {
     ((unsigned int *)ctx->hash.digest)[i] =
         ntohl(ntohl(((unsigned int *)ctx->hash.digest)[i]) + X[i + 1]);
 }
+#endif
+
+static void sha1_blocks_scalar(SHA1_Context *ctx, const BYTE *data,
+                               UINT32 blocks) {
+  for (; blocks; blocks--, data += 64)
+    process_block(ctx, data);
+}
+
+/**
+ * The block function used by sha1() and sha1_finish().
+ */
+static void (*sha1_blocks)(SHA1_Context *ctx, const BYTE *data,
+                           UINT32 blocks) = sha1_blocks_scalar;
+
+#ifdef SHA1_SIMD
+typedef unsigned int v4su __attribute__((vector_size(16)));
+typedef unsigned char v16qu __attribute__((vector_size(16)));
+typedef unsigned int v4su_unaligned
+    __attribute__((vector_size(16), aligned(1)));
+
+#define VROL(X, N) ((X) << (N) | (X) >> (32 - (N)))
+/* without pshufb, a byte shuffle is done byte by byte through memory */
+#define VBSWAP(X, PSHUFB)                                                      \
+  ((PSHUFB) ? (v4su)__builtin_shuffle((v16qu)(X),                              \
+                                      (v16qu){3, 2, 1, 0, 7, 6, 5, 4, 11, 10,  \
+                                              9, 8, 15, 14, 13, 12})           \
+            : (VROL(X, 8) & 0x00ff00ff) | (VROL(X, 24) & 0xff00ff00))
+#define VLOAD(p) VBSWAP(*(const v4su_unaligned *)(p), pshufb)
+
+/*
+ * Compute W(t)..W(t + 3) into X0, which holds W(t - 16)..W(t - 13) on entry,
+ * and store them with the round constant k[t / 20] added. W(t + 3) depends on
+ * W(t), so lane 3 is first computed without it and then fixed up, using
+ * ROL(x ^ W(t), 1) == ROL(x, 1) ^ ROL(tmp[0], 2).
+ */
+#define VEXPAND(X0, X1, X2, X3, t)                                             \
+  {                                                                            \
+    v4su tmp = X0 ^ __builtin_shuffle(X0, X1, (v4su){2, 3, 4, 5}) ^ X2 ^       \
+               __builtin_shuffle(X3, zero, (v4su){1, 2, 3, 4});                \
+    v4su fix = __builtin_shuffle(zero, tmp, (v4su){0, 1, 2, 4});               \
+    X0 = VROL(tmp, 1) ^ VROL(fix, 2);                                          \
+    *(v4su *)&wk[t] = X0 + k[(t) / 20];                                        \
+  }
+
+#define WK(t) w[t]
+
+/**
+ * Process blocks of 512 bits, computing the message schedule four words at
+ * a time. The wrappers below compile this same vector code for SSE2, SSSE3
+ * and AVX2, the schedule and rounds are not written per instruction set.
+ * They differ only in what the compiler may use: pshufb tells whether the
+ * byte swap may use SSSE3, and AVX2 brings VEX encoding and BMI2 rotates.
+ */
+static inline __attribute__((__always_inline__)) void
+sha1_blocks_simd(SHA1_Context *ctx, const BYTE *data, UINT32 blocks,
+                 const bool pshufb) {
+  u32_unaligned *h = (u32_unaligned *)ctx->hash.digest;
+  unsigned int wk[80] __attribute__((aligned(16))), *w;
+  const v4su zero = {0, 0, 0, 0};
+  const v4su k[4] = {{0x5A827999, 0x5A827999, 0x5A827999, 0x5A827999},
+                     {0x6ED9EBA1, 0x6ED9EBA1, 0x6ED9EBA1, 0x6ED9EBA1},
+                     {0x8F1BBCDC, 0x8F1BBCDC, 0x8F1BBCDC, 0x8F1BBCDC},
+                     {0xCA62C1D6, 0xCA62C1D6, 0xCA62C1D6, 0xCA62C1D6}};
+  v4su x0, x1, x2, x3;
+  unsigned int a, b, c, d, e, i, t;
+
+  for (; blocks; blocks--, data += 64) {
+    x0 = VLOAD(data);
+    x1 = VLOAD(data + 16);
+    x2 = VLOAD(data + 32);
+    x3 = VLOAD(data + 48);
+    *(v4su *)&wk[0] = x0 + k[0];
+    *(v4su *)&wk[4] = x1 + k[0];
+    *(v4su *)&wk[8] = x2 + k[0];
+    *(v4su *)&wk[12] = x3 + k[0];
+    for (i = 1; i < 5; i++) {
+      t = 16 * i;
+      VEXPAND(x0, x1, x2, x3, t);
+      VEXPAND(x1, x2, x3, x0, t + 4);
+      VEXPAND(x2, x3, x0, x1, t + 8);
+      VEXPAND(x3, x0, x1, x2, t + 12);
+    }
+
+    a = ntohl(h[0]);
+    b = ntohl(h[1]);
+    c = ntohl(h[2]);
+    d = ntohl(h[3]);
+    e = ntohl(h[4]);
+
+    for (w = wk; w < wk + 20; w += 5)
+      ROUND5(F1, 0, WK, 0);
+    for (; w < wk + 40; w += 5)
+      ROUND5(F2, 0, WK, 0);
+    for (; w < wk + 60; w += 5)
+      ROUND5(F3, 0, WK, 0);
+    for (; w < wk + 80; w += 5)
+      ROUND5(F2, 0, WK, 0);
+
+    h[0] = htonl(ntohl(h[0]) + a);
+    h[1] = htonl(ntohl(h[1]) + b);
+    h[2] = htonl(ntohl(h[2]) + c);
+    h[3] = htonl(ntohl(h[3]) + d);
+    h[4] = htonl(ntohl(h[4]) + e);
+  }
+}
+
+/* Our stack is not necessarily 16 byte aligned, hence force_align_arg_pointer
+ */
+static void __attribute__((target("sse2"), force_align_arg_pointer))
+sha1_blocks_vec_sse2(SHA1_Context *ctx, const BYTE *data, UINT32 blocks) {
+  sha1_blocks_simd(ctx, data, blocks, false);
+}
+
+static void __attribute__((target("ssse3"), force_align_arg_pointer))
+sha1_blocks_vec_ssse3(SHA1_Context *ctx, const BYTE *data, UINT32 blocks) {
+  sha1_blocks_simd(ctx, data, blocks, true);
+}
+
+static void __attribute__((target("avx2,bmi,bmi2"), force_align_arg_pointer))
+sha1_blocks_vec_avx2(SHA1_Context *ctx, const BYTE *data, UINT32 blocks) {
+  sha1_blocks_simd(ctx, data, blocks, true);
+}
+
+typedef int v4si __attribute__((vector_size(16)));
+typedef unsigned char v16qu_unaligned
+    __attribute__((vector_size(16), aligned(1)));
+
+#define NI_LOAD(p)                                                             \
+  ((v4si)__builtin_shuffle(                                                    \
+      *(const v16qu_unaligned *)(p),                                           \
+      (v16qu){15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0}))
+
+/*
+ * Four rounds with the SHA extensions, E1 is the next E and M0 holds
+ * W(t)..W(t + 3). The schedule of M1..M3 is advanced at the same time.
+ */
+#define NI4(E0, E1, M0, M1, M2, M3, F)                                         \
+  {                                                                            \
+    E0 = __builtin_ia32_sha1nexte(E0, M0);                                     \
+    E1 = abcd;                                                                 \
+    M1 = __builtin_ia32_sha1msg2(M1, M0);                                      \
+    abcd = __builtin_ia32_sha1rnds4(abcd, E0, F);                              \
+    M3 = __builtin_ia32_sha1msg1(M3, M0);                                      \
+    M2 ^= M0;                                                                  \
+  }
+
+/**
+ * Process blocks of 512 bits with the SHA-NI instructions. A..D are kept in
+ * one register (A in the highest lane), E in the highest lane of another.
+ */
+static void __attribute__((target("sha,sse4.1"), force_align_arg_pointer))
+sha1_blocks_shani(SHA1_Context *ctx, const BYTE *data, UINT32 blocks) {
+  u32_unaligned *h = (u32_unaligned *)ctx->hash.digest;
+  v4si abcd = NI_LOAD(h), abcd_save, e0, e0_save, e1, m0, m1, m2, m3;
+
+  e0 = (v4si){0, 0, 0, ntohl(h[4])};
+  for (; blocks; blocks--, data += 64) {
+    abcd_save = abcd;
+    e0_save = e0;
+
+    m0 = NI_LOAD(data);
+    e0 += m0;
+    e1 = abcd;
+    abcd = __builtin_ia32_sha1rnds4(abcd, e0, 0);
+
+    m1 = NI_LOAD(data + 16);
+    e1 = __builtin_ia32_sha1nexte(e1, m1);
+    e0 = abcd;
+    abcd = __builtin_ia32_sha1rnds4(abcd, e1, 0);
+    m0 = __builtin_ia32_sha1msg1(m0, m1);
+
+    m2 = NI_LOAD(data + 32);
+    e0 = __builtin_ia32_sha1nexte(e0, m2);
+    e1 = abcd;
+    abcd = __builtin_ia32_sha1rnds4(abcd, e0, 0);
+    m1 = __builtin_ia32_sha1msg1(m1, m2);
+    m0 ^= m2;
+
+    m3 = NI_LOAD(data + 48);
+    NI4(e1, e0, m3, m0, m1, m2, 0);
+    NI4(e0, e1, m0, m1, m2, m3, 0);
+    NI4(e1, e0, m1, m2, m3, m0, 1);
+    NI4(e0, e1, m2, m3, m0, m1, 1);
+    NI4(e1, e0, m3, m0, m1, m2, 1);
+    NI4(e0, e1, m0, m1, m2, m3, 1);
+    NI4(e1, e0, m1, m2, m3, m0, 1);
+    NI4(e0, e1, m2, m3, m0, m1, 2);
+    NI4(e1, e0, m3, m0, m1, m2, 2);
+    NI4(e0, e1, m0, m1, m2, m3, 2);
+    NI4(e1, e0, m1, m2, m3, m0, 2);
+    NI4(e0, e1, m2, m3, m0, m1, 2);
+    NI4(e1, e0, m3, m0, m1, m2, 3);
+    NI4(e0, e1, m0, m1, m2, m3, 3);
+
+    e1 = __builtin_ia32_sha1nexte(e1, m1);
+    e0 = abcd;
+    m2 = __builtin_ia32_sha1msg2(m2, m1);
+    abcd = __builtin_ia32_sha1rnds4(abcd, e1, 3);
+    m3 ^= m1;
+
+    e0 = __builtin_ia32_sha1nexte(e0, m2);
+    e1 = abcd;
+    m3 = __builtin_ia32_sha1msg2(m3, m2);
+    abcd = __builtin_ia32_sha1rnds4(abcd, e0, 3);
+
+    e1 = __builtin_ia32_sha1nexte(e1, m3);
+    e0 = abcd;
+    abcd = __builtin_ia32_sha1rnds4(abcd, e1, 3);
+
+    e0 = __builtin_ia32_sha1nexte(e0, e0_save);
+    abcd += abcd_save;
+  }
+
+  *(v4su_unaligned *)h = (v4su)NI_LOAD(&abcd);
+  h[4] = htonl(e0[3]);
+}
+
+enum sha1_simd_consts {
+  CPUID_1_ECX_SSSE3 = 1 << 9,
+  CPUID_1_ECX_SSE41 = 1 << 19,
+  CPUID_1_ECX_XSAVE = 1 << 26,
+  CPUID_1_ECX_AVX = 1 << 28,
+  CPUID_1_EDX_FXSR = 1 << 24,
+  CPUID_1_EDX_SSE2 = 1 << 26,
+  CPUID_7_EBX_BMI1 = 1 << 3,
+  CPUID_7_EBX_AVX2 = 1 << 5,
+  CPUID_7_EBX_BMI2 = 1 << 8,
+  CPUID_7_EBX_SHA = 1 << 29,
+  XCR0_X87 = 1 << 0,
+  XCR0_SSE = 1 << 1,
+  XCR0_AVX = 1 << 2,
+};
+
+static struct {
+  unsigned long cr0;
+  unsigned long cr4;
+  unsigned long long xcr0;
+} simd_saved;
+
+/**
+ * Enable the SSE (and if needed AVX) state and select the fastest block
+ * function this CPU supports: SHA-NI, or the vector one compiled for AVX2,
+ * SSSE3 or SSE2. Until sha1_simd_end() is called, nothing else may rely on
+ * CR0, CR4 or XCR0 being unchanged.
+ */
+void sha1_simd_begin(void) {
+  unsigned int ecx = cpuid_ecx(1);
+  unsigned int edx = cpuid_edx(1);
+  unsigned int ebx7 = cpuid_eax(0) >= 7 ? cpuid_ebx1(7, 0) : 0;
+  const unsigned int avx2 = CPUID_7_EBX_AVX2 | CPUID_7_EBX_BMI1 |
+                            CPUID_7_EBX_BMI2;
+
+  if (!(edx & CPUID_1_EDX_FXSR) || !(edx & CPUID_1_EDX_SSE2))
+    return;
+
+  simd_saved.cr0 = read_cr0();
+  simd_saved.cr4 = read_cr4();
+  write_cr0((simd_saved.cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP);
+  write_cr4(simd_saved.cr4 | CR4_FXSR | CR4_XMM);
+  sha1_blocks = sha1_blocks_vec_sse2;
+
+  if (ecx & CPUID_1_ECX_SSSE3)
+    sha1_blocks = sha1_blocks_vec_ssse3;
+
+  if ((ebx7 & CPUID_7_EBX_SHA) && (ecx & CPUID_1_ECX_SSSE3) &&
+      (ecx & CPUID_1_ECX_SSE41))
+    sha1_blocks = sha1_blocks_shani;
+  else if ((ecx & CPUID_1_ECX_XSAVE) && (ecx & CPUID_1_ECX_AVX) &&
+           (ebx7 & avx2) == avx2) {
+    write_cr4(read_cr4() | CR4_OSXSAVE);
+    simd_saved.xcr0 = xgetbv(0);
+    xsetbv(0, simd_saved.xcr0 | XCR0_X87 | XCR0_SSE | XCR0_AVX);
+    sha1_blocks = sha1_blocks_vec_avx2;
+  }
+}
+
+/**
+ * Restore the control registers saved by sha1_simd_begin() and fall back to
+ * the scalar block function.
+ */
+void sha1_simd_end(void) {
+  if (sha1_blocks == sha1_blocks_scalar)
+    return;
+  if (sha1_blocks == sha1_blocks_vec_avx2)
+    xsetbv(0, simd_saved.xcr0);
+  write_cr4(simd_saved.cr4);
+  write_cr0(simd_saved.cr0);
+  sha1_blocks = sha1_blocks_scalar;
+}
+
+/* compute the message schedule in place while doing the rounds */
+#define MW(t)                                                                  \
+  (w[(t)&15] = (t) < 16 ? w[(t)&15]                                            \
+                        : ROL(w[((t)-3) & 15] ^ w[((t)-8) & 15] ^              \
+                                  w[((t)-14) & 15] ^ w[(t)&15],                \
+                              1))
+
+#define LANE_LOAD(t)                                                           \
+  (v4su) {                                                                     \
+    ntohl(((const UINT32 *)p[0])[t]), ntohl(((const UINT32 *)p[1])[t]),        \
+        ntohl(((const UINT32 *)p[2])[t]), ntohl(((const UINT32 *)p[3])[t])     \
+  }
+
+/**
+ * Process one block of four independent messages at once, lane i of every
+ * word in state belongs to the message p[i] points to.
+ */
+static void __attribute__((target("sse2"), force_align_arg_pointer))
+sha1_lanes_sse2(unsigned int state[5][4], const BYTE *const p[4]) {
+  v4su_unaligned *h = (v4su_unaligned *)state;
+  v4su w[16], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+  unsigned int t;
+
+  for (t = 0; t < 16; t++)
+    w[t] = LANE_LOAD(t);
+
+  // one round per iteration, the vectors are rotated instead of the names
+  for (t = 0; t < 80; t++) {
+    v4su f;
+    if (t < 20)
+      f = F1(b, c, d) + 0x5A827999;
+    else if (t < 40 || t >= 60)
+      f = F2(b, c, d) + (t < 40 ? 0x6ED9EBA1 : 0xCA62C1D6);
+    else
+      f = F3(b, c, d) + 0x8F1BBCDC;
+    f += ROL(a, 5) + e + MW(t);
+    e = d;
+    d = c;
+    c = ROL(b, 30);
+    b = a;
+    a = f;
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+/**
+ * Hash the whole blocks of the jobs four at a time, as long as at least two
+ * of them have blocks left. Leaves the rest to sha1_stream().
+ */
+static void sha1_multi_lanes(SHA1_Job *jobs, UINT32 count) {
+  unsigned int state[5][4];
+  const BYTE *p[4];
+  SHA1_Job *lane[4] = {NULL, NULL, NULL, NULL};
+  UINT32 i, l, n, active, next = 0;
+
+  // bring every context to a block boundary first
+  for (i = 0; i < count; i++) {
+    n = 64 - jobs[i].ctx->index;
+    if (n == 64)
+      continue;
+    n = n < jobs[i].count ? n : jobs[i].count;
+    sha1_stream(jobs[i].ctx, jobs[i].data, n);
+    jobs[i].data += n;
+    jobs[i].count -= n;
+  }
+
+  for (;;) {
+    active = 0;
+    for (l = 0; l < 4; l++) {
+      if (lane[l] && lane[l]->count < 64) {
+        for (i = 0; i < 5; i++)
+          ((UINT32 *)lane[l]->ctx->hash.digest)[i] = htonl(state[i][l]);
+        lane[l] = NULL;
+      }
+      for (; !lane[l] && next < count; next++)
+        if (jobs[next].count >= 64) {
+          lane[l] = jobs + next;
+          for (i = 0; i < 5; i++)
+            state[i][l] = ntohl(((UINT32 *)lane[l]->ctx->hash.digest)[i]);
+        }
+      if (lane[l])
+        p[active++] = lane[l]->data;
+    }
+    if (active < 2)
+      break;
+
+    // idle lanes hash a copy of another lane and are never stored
+    for (l = 0; l < 4; l++)
+      p[l] = lane[l] ? lane[l]->data : p[0];
+    sha1_lanes_sse2(state, p);
+
+    for (l = 0; l < 4; l++)
+      if (lane[l]) {
+        lane[l]->data += 64;
+        lane[l]->count -= 64;
+        lane[l]->ctx->blocks++;
+      }
+  }
+
+  for (l = 0; l < 4; l++)
+    if (lane[l])
+      for (i = 0; i < 5; i++)
+        ((UINT32 *)lane[l]->ctx->hash.digest)[i] = htonl(state[i][l]);
+}
+#endif
 
 /**
  * @param ctx    - store immediate values like unprocessed bytes and the overall
@@ -90,6 +578,57 @@ void sha1_init(SHA1_Context *ctx) {
   ((UINT32 *)ctx->hash.digest)[4] = 0xf0e1d2c3;
 }
 
+/**
+ * Continue a hash whose first 64-byte block has already been compressed into
+ * state, like the key block of an HMAC.
+ */
+void sha1_resume(SHA1_Context *ctx, const TPM_DIGEST *state) {
+  ctx->index = 0;
+  ctx->blocks = 1;
+  ctx->hash = *state;
+}
+
+/**
+ * Hash count bytes from value. Whole blocks are hashed in place, so as long
+ * as every call but the last passes a multiple of 64 bytes, no data is
+ * copied. This is meant for feeding large inputs in big strides.
+ *
+ * @param ctx    - store immediate values like unprocessed bytes and the overall
+ * length
+ * @param value  - a string to hash
+ * @param count  - the number of characters in value
+ */
+void sha1_stream(SHA1_Context *ctx, const void *val, UINT32 count) {
+  const BYTE *value = val;
+  UINT32 n;
+
+  // complete a partially filled buffer first
+  if (ctx->index) {
+    n = 64 - ctx->index < count ? 64 - ctx->index : count;
+    memcpy(ctx->buffer + ctx->index, value, n);
+    ctx->index += n;
+    value += n;
+    count -= n;
+    if (ctx->index < 64)
+      return;
+    sha1_blocks(ctx, ctx->buffer, 1);
+    ctx->blocks++;
+    ctx->index = 0;
+  }
+
+  // hash all complete blocks in place
+  n = count >> 6;
+  if (n) {
+    sha1_blocks(ctx, value, n);
+    ctx->blocks += n;
+    value += n << 6;
+    count &= 63;
+  }
+
+  memcpy(ctx->buffer, value, count);
+  ctx->index = count;
+}
+
 /**
  * EXCEPT: ERROR_SHA1_DATA_SIZE
  *
@@ -102,21 +641,34 @@ void sha1_init(SHA1_Context *ctx) {
  */
 RESULT sha1(SHA1_Context *ctx, const void *val, UINT32 count) {
   RESULT ret = {.exception.error = NONE};
-  const BYTE *value = val;
-  for (; count + ctx->index >= 64;
-       count -= 64 - ctx->index, value += 64 - ctx->index, ctx->index = 0) {
-    memcpy(ctx->buffer + ctx->index, value, 64 - ctx->index);
-    process_block(ctx);
-    ctx->blocks++;
-    ERROR(ctx->blocks >= 1 << 23, ERROR_SHA1_DATA_SIZE,
-          "SHA data exceeds maximum size");
-  }
 
-  memcpy(ctx->buffer + ctx->index, value, count);
-  ctx->index += count;
+  sha1_stream(ctx, val, count);
+  /* the message length in bits has to fit into 64 bits */
+  ERROR(ctx->blocks >> 55, ERROR_SHA1_DATA_SIZE,
+        "SHA data exceeds maximum size");
   return ret;
 }
 
+/**
+ * Hash several independent messages, like sha1_stream() does for each job
+ * in turn. When the SIMD state is enabled and no SHA-NI is available, whole
+ * blocks of different jobs are interleaved in vector lanes. The data and
+ * count of each job are consumed.
+ */
+void sha1_multi(SHA1_Job *jobs, UINT32 count) {
+  UINT32 i;
+
+#ifdef SHA1_SIMD
+  if (sha1_blocks != sha1_blocks_scalar && sha1_blocks != sha1_blocks_shani)
+    sha1_multi_lanes(jobs, count);
+#endif
+  for (i = 0; i < count; i++) {
+    sha1_stream(jobs[i].ctx, jobs[i].data, jobs[i].count);
+    jobs[i].data += jobs[i].count;
+    jobs[i].count = 0;
+  }
+}
+
 /**
  * Finish the operation. The output is available in ctx->hash.
  */
@@ -126,15 +678,14 @@ void sha1_finish(SHA1_Context *ctx) {
     ctx->buffer[i] = 0;
 
   if (ctx->index > 55) {
-    process_block(ctx);
+    sha1_blocks(ctx, ctx->buffer, 1);
     for (unsigned i = 0; i < 64; i++)
       ctx->buffer[i] = 0;
   }
 
-  /* using a 32bit value for blocks and not using the upper bits of
-     tmp limits the maximum hash size to 512 MB. */
-  unsigned long long tmp = (ctx->blocks << 9) + (ctx->index << 3);
-  ((unsigned long *)ctx->buffer)[15] = ntohl(tmp & 0xffffffff);
-  process_block(ctx);
+  UINT64 bits = (ctx->blocks << 9) + (ctx->index << 3);
+  ((UINT32 *)ctx->buffer)[14] = htonl(bits >> 32);
+  ((UINT32 *)ctx->buffer)[15] = htonl(bits);
+  sha1_blocks(ctx, ctx->buffer, 1);
 }
 #endif
@@ -0,0 +1,279 @@
+/*
+ * \brief   A SHA-256 implementation with the same interface as sha.c.
+ * A size optimized compression function that unrolls eight rounds, and with
+ * SHA1_SIMD a SHA-NI one that sha256_simd_begin() selects.
+ */
+
+#ifndef ISABELLE
+#include "asm.h"
+#include "sha256.h"
+#include "util.h"
+
+#define ROR(VALUE, COUNT) ((VALUE) >> COUNT | (VALUE) << (32 - COUNT))
+
+#define S0(X) (ROR(X, 2) ^ ROR(X, 13) ^ ROR(X, 22))
+#define S1(X) (ROR(X, 6) ^ ROR(X, 11) ^ ROR(X, 25))
+#define s0(X) (ROR(X, 7) ^ ROR(X, 18) ^ ((X) >> 3))
+#define s1(X) (ROR(X, 17) ^ ROR(X, 19) ^ ((X) >> 10))
+#define CH(E, F, G) ((G) ^ ((E) & ((F) ^ (G))))
+#define MAJ(A, B, C) (((A) & (B)) | ((C) & ((A) | (B))))
+
+/* SHA256_Context is packed, its state may be at any address */
+typedef UINT32 u32_unaligned __attribute__((aligned(1)));
+
+static const UINT32 k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define LOAD(t) (w[t] = ntohl(((const UINT32 *)data)[t]))
+#define EXPAND(t)                                                              \
+  (w[(t)&15] += s1(w[((t)-2) & 15]) + w[((t)-7) & 15] + s0(w[((t)-15) & 15]))
+
+#define ROUND(A, B, C, D, E, F, G, H, W, t)                                    \
+  {                                                                            \
+    H += S1(E) + CH(E, F, G) + k[t] + W(t);                                    \
+    D += H;                                                                    \
+    H += S0(A) + MAJ(A, B, C);                                                 \
+  }
+
+/* eight rounds rotate the variable names back into place */
+#define ROUND8(W, t)                                                           \
+  {                                                                            \
+    ROUND(a, b, c, d, e, f, g, h, W, t);                                       \
+    ROUND(h, a, b, c, d, e, f, g, W, t + 1);                                   \
+    ROUND(g, h, a, b, c, d, e, f, W, t + 2);                                   \
+    ROUND(f, g, h, a, b, c, d, e, W, t + 3);                                   \
+    ROUND(e, f, g, h, a, b, c, d, W, t + 4);                                   \
+    ROUND(d, e, f, g, h, a, b, c, W, t + 5);                                   \
+    ROUND(c, d, e, f, g, h, a, b, W, t + 6);                                   \
+    ROUND(b, c, d, e, f, g, h, a, W, t + 7);                                   \
+  }
+
+static void sha256_blocks_scalar(SHA256_Context *ctx, const BYTE *data,
+                                 UINT32 blocks) {
+  u32_unaligned *s = ctx->state;
+  UINT32 w[16], a, b, c, d, e, f, g, h, t;
+
+  for (; blocks; blocks--, data += 64) {
+    a = s[0];
+    b = s[1];
+    c = s[2];
+    d = s[3];
+    e = s[4];
+    f = s[5];
+    g = s[6];
+    h = s[7];
+
+    for (t = 0; t < 16; t += 8)
+      ROUND8(LOAD, t);
+    for (t = 16; t < 64; t += 8)
+      ROUND8(EXPAND, t);
+
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+  }
+}
+
+/**
+ * The block function used by sha256_stream() and sha256_finish().
+ */
+static void (*sha256_blocks)(SHA256_Context *ctx, const BYTE *data,
+                             UINT32 blocks) = sha256_blocks_scalar;
+
+#ifdef SHA1_SIMD
+typedef int v4si __attribute__((vector_size(16)));
+typedef unsigned char v16qu __attribute__((vector_size(16)));
+typedef int v4si_unaligned
+    __attribute__((vector_size(16), aligned(1), may_alias));
+
+#define NI_LOAD(p)                                                             \
+  ((v4si)__builtin_shuffle((v16qu)(*(const v4si_unaligned *)(p)),             \
+                           (v16qu){3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15,   \
+                                   14, 13, 12}))
+#define NI_K(t) (*(const v4si_unaligned *)&k[t])
+/* the upper two words of X, the second pair of rounds only uses those */
+#define NI_HIGH(X) __builtin_shuffle(X, (v4si){2, 3, 2, 3})
+/* alignr by four bytes: X1..X3 followed by Y0 */
+#define NI_ALIGN4(Y, X) __builtin_shuffle(X, Y, (v4si){1, 2, 3, 4})
+
+#define NI_RNDS4(M, t)                                                         \
+  {                                                                            \
+    msg = M + NI_K(t);                                                         \
+    cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, msg);                        \
+    abef = __builtin_ia32_sha256rnds2(abef, cdgh, NI_HIGH(msg));               \
+  }
+
+/*
+ * Four rounds using M0, which holds W(t)..W(t + 3), while completing
+ * W(t + 4)..W(t + 7) in M1 and starting W(t + 12)..W(t + 15) in M3.
+ */
+#define NI4(M0, M1, M3, t)                                                     \
+  {                                                                            \
+    msg = M0 + NI_K(t);                                                        \
+    cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, msg);                        \
+    M1 = __builtin_ia32_sha256msg2(M1 + NI_ALIGN4(M0, M3), M0);                \
+    abef = __builtin_ia32_sha256rnds2(abef, cdgh, NI_HIGH(msg));               \
+    M3 = __builtin_ia32_sha256msg1(M3, M0);                                    \
+  }
+
+/**
+ * Process blocks of 512 bits with the SHA-NI instructions, which keep the
+ * state as A, B, E, F and C, D, G, H in two registers.
+ */
+static void __attribute__((target("sha,sse4.1"), force_align_arg_pointer))
+sha256_blocks_shani(SHA256_Context *ctx, const BYTE *data, UINT32 blocks) {
+  v4si_unaligned *s = (v4si_unaligned *)ctx->state;
+  v4si abcd = s[0], efgh = s[1];
+  v4si abef = __builtin_shuffle(efgh, abcd, (v4si){1, 0, 5, 4});
+  v4si cdgh = __builtin_shuffle(efgh, abcd, (v4si){3, 2, 7, 6});
+  v4si abef_save, cdgh_save, msg, m0, m1, m2, m3;
+
+  for (; blocks; blocks--, data += 64) {
+    abef_save = abef;
+    cdgh_save = cdgh;
+
+    m0 = NI_LOAD(data);
+    NI_RNDS4(m0, 0);
+    m1 = NI_LOAD(data + 16);
+    NI_RNDS4(m1, 4);
+    m0 = __builtin_ia32_sha256msg1(m0, m1);
+    m2 = NI_LOAD(data + 32);
+    NI_RNDS4(m2, 8);
+    m1 = __builtin_ia32_sha256msg1(m1, m2);
+    m3 = NI_LOAD(data + 48);
+
+    NI4(m3, m0, m2, 12);
+    NI4(m0, m1, m3, 16);
+    NI4(m1, m2, m0, 20);
+    NI4(m2, m3, m1, 24);
+    NI4(m3, m0, m2, 28);
+    NI4(m0, m1, m3, 32);
+    NI4(m1, m2, m0, 36);
+    NI4(m2, m3, m1, 40);
+    NI4(m3, m0, m2, 44);
+    NI4(m0, m1, m3, 48);
+
+    msg = m1 + NI_K(52);
+    cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, msg);
+    m2 = __builtin_ia32_sha256msg2(m2 + NI_ALIGN4(m1, m0), m1);
+    abef = __builtin_ia32_sha256rnds2(abef, cdgh, NI_HIGH(msg));
+
+    msg = m2 + NI_K(56);
+    cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, msg);
+    m3 = __builtin_ia32_sha256msg2(m3 + NI_ALIGN4(m2, m1), m2);
+    abef = __builtin_ia32_sha256rnds2(abef, cdgh, NI_HIGH(msg));
+
+    NI_RNDS4(m3, 60);
+
+    abef += abef_save;
+    cdgh += cdgh_save;
+  }
+
+  s[0] = __builtin_shuffle(abef, cdgh, (v4si){3, 2, 7, 6});
+  s[1] = __builtin_shuffle(abef, cdgh, (v4si){1, 0, 5, 4});
+}
+
+enum sha256_simd_consts {
+  CPUID_1_ECX_SSSE3 = 1 << 9,
+  CPUID_1_ECX_SSE41 = 1 << 19,
+  CPUID_7_EBX_SHA = 1 << 29,
+};
+
+void sha256_simd_begin(void) {
+  unsigned int ecx = cpuid_ecx(1);
+  unsigned int ebx7 = cpuid_eax(0) >= 7 ? cpuid_ebx1(7, 0) : 0;
+
+  if ((read_cr4() & CR4_XMM) && (ebx7 & CPUID_7_EBX_SHA) &&
+      (ecx & CPUID_1_ECX_SSSE3) && (ecx & CPUID_1_ECX_SSE41))
+    sha256_blocks = sha256_blocks_shani;
+}
+
+void sha256_simd_end(void) { sha256_blocks = sha256_blocks_scalar; }
+#endif
+
+void sha256_init(SHA256_Context *ctx) {
+  ctx->index = 0;
+  ctx->blocks = 0;
+
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+}
+
+/**
+ * Hash count bytes from value, see sha1_stream().
+ */
+void sha256_stream(SHA256_Context *ctx, const void *val, UINT32 count) {
+  const BYTE *value = val;
+  UINT32 n;
+
+  // complete a partially filled buffer first
+  if (ctx->index) {
+    n = 64 - ctx->index < count ? 64 - ctx->index : count;
+    memcpy(ctx->buffer + ctx->index, value, n);
+    ctx->index += n;
+    value += n;
+    count -= n;
+    if (ctx->index < 64)
+      return;
+    sha256_blocks(ctx, ctx->buffer, 1);
+    ctx->blocks++;
+    ctx->index = 0;
+  }
+
+  // hash all complete blocks in place
+  n = count >> 6;
+  if (n) {
+    sha256_blocks(ctx, value, n);
+    ctx->blocks += n;
+    value += n << 6;
+    count &= 63;
+  }
+
+  memcpy(ctx->buffer, value, count);
+  ctx->index = count;
+}
+
+/**
+ * Finish the operation. The output is available in ctx->hash.
+ */
+void sha256_finish(SHA256_Context *ctx) {
+  ctx->buffer[ctx->index] = 0x80;
+  for (unsigned i = ctx->index + 1; i < 64; i++)
+    ctx->buffer[i] = 0;
+
+  if (ctx->index > 55) {
+    sha256_blocks(ctx, ctx->buffer, 1);
+    for (unsigned i = 0; i < 64; i++)
+      ctx->buffer[i] = 0;
+  }
+
+  UINT64 bits = (ctx->blocks << 9) + (ctx->index << 3);
+  ((UINT32 *)ctx->buffer)[14] = htonl(bits >> 32);
+  ((UINT32 *)ctx->buffer)[15] = htonl(bits);
+  sha256_blocks(ctx, ctx->buffer, 1);
+
+  for (unsigned i = 0; i < 8; i++)
+    ((UINT32 *)ctx->hash.digest)[i] = htonl(ctx->state[i]);
+}
+#endif
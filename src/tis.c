@@ -16,15 +16,34 @@
 #include "asm.h"
 #include "alloc.h"
 #include "util.h"
+#include "tcg.h"
 #include "tis.h"
+#ifdef TIS_IRQ
+#include "irq.h"
+#endif
 
 RESULT_GEN(int);
 
+/*
+ * All TIS register accesses go through TIS_READ() and TIS_WRITE(), so that
+ * the host bench can route them to its emulated TPM.
+ */
+#ifdef TIS_HOST
+#define TIS_READ(reg)                                                          \
+  ((__typeof__(reg))tis_host_read((unsigned long)&(reg), sizeof(reg)))
+#define TIS_WRITE(reg, value)                                                  \
+  tis_host_write((unsigned long)&(reg), sizeof(reg), (value))
+#else
+#define TIS_READ(reg) (reg)
+#define TIS_WRITE(reg, value) ((reg) = (value))
+#endif
+
 struct TIS_BUFFERS tis_buffers = {.in = {0}, .out = {0}};
 
 typedef struct {
   TPM_TAG tag;
   UINT32 paramSize;
+  UINT32 ordinal; // the returnCode in a response
 } TPM_COMMAND_HEADER;
 
 /**
@@ -32,6 +51,204 @@ typedef struct {
  */
 static int tis_locality;
 
+/**
+ * Whether the FIFO of the locality may be accessed 4 bytes at a time.
+ */
+static bool tis_fifo_dword;
+
+unsigned int tis_mmio_count;
+
+/**
+ * TIS_TIMEOUT_A-D and the command durations in microseconds. The TIS spec
+ * defaults are copied by tis_init(), and replaced by tis_set_timeouts() with
+ * the values the TPM reports. The table is in the bss, as the data section
+ * is part of the measured SLB and must not change before the late launch.
+ */
+static const unsigned int tis_default_timeouts[TIS_TIMEOUT_MAX] = {
+    [TIS_TIMEOUT_A] = 750000,         [TIS_TIMEOUT_B] = 2000000,
+    [TIS_TIMEOUT_C] = 750000,         [TIS_TIMEOUT_D] = 750000,
+    [TIS_DURATION_SHORT] = 2000000,   [TIS_DURATION_MEDIUM] = 20000000,
+    [TIS_DURATION_LONG] = 60000000,
+};
+unsigned int tis_timeouts[TIS_TIMEOUT_MAX];
+
+/* Longer than any TPM 1.2 command takes, a longer timeout is not believed */
+#define TIS_TIMEOUT_LIMIT 600000000
+
+/**
+ * TSC ticks per microsecond, calibrated against the PIT by tis_init(). A
+ * CPU runs its TSC at between 100 MHz and 10 GHz.
+ */
+#define TIS_TSC_PER_US_MIN 100
+#define TIS_TSC_PER_US_MAX 10000
+static unsigned int tis_tsc_per_us;
+
+#ifdef TIS_TRACE
+/**
+ * The ring of traced commands, the current record is at count - 1.
+ * tsc is the time stamp at which the current phase began.
+ */
+static struct {
+  struct tis_trace_record *ring;
+  unsigned int size;
+  unsigned int count;
+  unsigned long long tsc;
+} tis_trace;
+
+#define TRACE(call) call
+
+void tis_trace_start(struct tis_trace_record *ring, unsigned int size) {
+  tis_trace.ring = ring;
+  tis_trace.size = size;
+  tis_trace.count = 0;
+}
+
+static void tis_trace_begin(UINT32 ordinal, UINT32 size) {
+  if (!tis_trace.ring)
+    return;
+  struct tis_trace_record *r =
+      tis_trace.ring + tis_trace.count++ % tis_trace.size;
+  memset(r, 0, sizeof(*r));
+  r->ordinal = ordinal;
+  r->in_size = size;
+  tis_trace.tsc = rdtsc();
+}
+
+/**
+ * Record the end of a phase of the current command. A command that failed
+ * keeps zero ticks in the phases it did not reach.
+ */
+static void tis_trace_lap(enum TIS_TRACE_PHASE phase, UINT32 size) {
+  if (!tis_trace.ring || !tis_trace.count)
+    return;
+  struct tis_trace_record *r =
+      tis_trace.ring + (tis_trace.count - 1) % tis_trace.size;
+  unsigned long long now = rdtsc();
+  unsigned long long ticks = now - tis_trace.tsc;
+  r->ticks[phase] = ticks >> 32 ? ~0ul : (UINT32)ticks;
+  if (phase == TIS_TRACE_READ)
+    r->out_size = size;
+  tis_trace.tsc = now;
+}
+
+static UINT32 tis_trace_us(const struct tis_trace_record *r) {
+  UINT32 ticks = 0;
+  for (int i = 0; i < TIS_TRACE_PHASES; i++)
+    ticks = ticks + r->ticks[i] < ticks ? ~0ul : ticks + r->ticks[i];
+  return ticks / tis_tsc_per_us;
+}
+
+/**
+ * One line per ordinal with: the count, the min/avg/max time from the first
+ * written byte to the last read one, and the average time the TPM took to
+ * execute. All values are hex, the times in microseconds.
+ */
+void tis_trace_dump(void) {
+  unsigned int n = tis_trace.count < tis_trace.size ? tis_trace.count
+                                                     : tis_trace.size;
+
+  out_description("TPM commands", tis_trace.count);
+  for (unsigned int i = 0; i < n; i++) {
+    const struct tis_trace_record *r = tis_trace.ring + i;
+    unsigned int j, count = 0;
+    UINT32 min = ~0ul, max = 0, sum = 0, execute = 0;
+
+    // only the first record of an ordinal prints its line
+    for (j = 0; j < i && tis_trace.ring[j].ordinal != r->ordinal; j++)
+      ;
+    if (j < i)
+      continue;
+    for (; j < n; j++) {
+      const struct tis_trace_record *o = tis_trace.ring + j;
+      if (o->ordinal != r->ordinal)
+        continue;
+      UINT32 us = tis_trace_us(o);
+      count++;
+      min = us < min ? us : min;
+      max = us > max ? us : max;
+      sum += us;
+      execute += o->ticks[TIS_TRACE_EXECUTE] / tis_tsc_per_us;
+    }
+    out_string("SABLE:   ordinal 0x");
+    out_hex(r->ordinal, 0);
+    out_string(" n 0x");
+    out_hex(count, 0);
+    out_string(" min/avg/max 0x");
+    out_hex(min, 0);
+    out_string("/0x");
+    out_hex(sum / count, 0);
+    out_string("/0x");
+    out_hex(max, 0);
+    out_string(" execute 0x");
+    out_hex(execute / count, 0);
+    out_string(" us\n");
+  }
+}
+#else
+#define TRACE(call)
+#endif
+
+/**
+ * The duration class of the command in flight.
+ */
+static enum TIS_TIMEOUT tis_duration;
+
+/**
+ * The command that runs without anybody waiting for its response, see
+ * tis_detach(): its locality and the TSC value by which it is done, or zero.
+ */
+static struct {
+  int locality;
+  unsigned long long deadline;
+} tis_detached;
+
+#ifdef TIS_IRQ
+/**
+ * Whether the locality signals its state changes with an interrupt.
+ */
+static bool tis_irq;
+
+/**
+ * Enable the dataAvail, stsValid and commandReady interrupts on the SIRQ
+ * line the firmware assigned to the locality. Polling stays the fallback.
+ */
+static void tis_irq_enable(volatile struct TIS_MMAP *mmap) {
+  tis_irq = irq_init(TIS_READ(mmap->int_vector) & 0xf);
+  if (tis_irq)
+    TIS_WRITE(mmap->int_enable,
+              (TIS_READ(mmap->int_enable) & TIS_INT_POLARITY) |
+                  TIS_INT_GLOBAL | TIS_INT_CMD_READY | TIS_INT_STS_VALID |
+                  TIS_INT_DATA_AVAIL);
+}
+
+static void tis_irq_disable(void) {
+  if (!tis_irq)
+    return;
+  volatile struct TIS_MMAP *mmap = (struct TIS_MMAP *)tis_locality;
+  TIS_WRITE(mmap->int_enable, TIS_READ(mmap->int_enable) & TIS_INT_POLARITY);
+  TIS_WRITE(mmap->int_status, TIS_READ(mmap->int_status));
+  irq_exit();
+  tis_irq = false;
+}
+#endif
+
+/**
+ * Replace count timeouts starting with first by the values the TPM reported.
+ * Zero values are ignored, values below a millisecond are taken as
+ * milliseconds, as some TPMs report them in the wrong unit. Values longer
+ * than TIS_TIMEOUT_LIMIT are ignored as well.
+ */
+void tis_set_timeouts(enum TIS_TIMEOUT first, const UINT32 *values,
+                      unsigned int count) {
+  for (unsigned i = 0; i < count; i++) {
+    UINT32 value = values[i];
+    if (value && value < 1000)
+      value *= 1000;
+    if (value && value <= TIS_TIMEOUT_LIMIT)
+      tis_timeouts[first + i] = value;
+  }
+}
+
 /**
  * Init the TIS driver.
  * Returns a TIS_INIT_* value.
@@ -43,48 +260,141 @@ enum TIS_TPM_VENDOR tis_init() {
   id = (struct TIS_ID *)(TIS_BASE + TPM_DID_VID_0);
   mmap = (struct TIS_MMAP *)(TIS_BASE);
 
+  // after the late launch, the values of prepare_tpm() come from the .bss,
+  // which is not measured, so only those within the bounds are kept
+  for (unsigned i = 0; i < TIS_TIMEOUT_MAX; i++)
+    if (tis_timeouts[i] < 1000 || tis_timeouts[i] > TIS_TIMEOUT_LIMIT)
+      tis_timeouts[i] = tis_default_timeouts[i];
+
+  // the timeouts are measured with the TSC, count its ticks in a millisecond
+  if (tis_tsc_per_us < TIS_TSC_PER_US_MIN ||
+      tis_tsc_per_us > TIS_TSC_PER_US_MAX) {
+    unsigned long long tsc = rdtsc();
+    wait(1);
+    tis_tsc_per_us = (unsigned int)(rdtsc() - tsc) / 1000;
+    if (tis_tsc_per_us < TIS_TSC_PER_US_MIN)
+      tis_tsc_per_us = TIS_TSC_PER_US_MIN;
+    if (tis_tsc_per_us > TIS_TSC_PER_US_MAX)
+      tis_tsc_per_us = TIS_TSC_PER_US_MAX;
+  }
+
   /**
    * There are these buggy ATMEL TPMs that return -1 as did_vid if the
    * locality0 is not accessed!
    */
-  if ((id->did_vid == -1) && ((mmap->intf_capability & ~0x1fa) == 5) &&
-      ((mmap->access & 0xe8) == 0x80)) {
+  if ((TIS_READ(id->did_vid) == -1) &&
+      ((TIS_READ(mmap->intf_capability) & ~0x1fa) == 5) &&
+      ((TIS_READ(mmap->access) & 0xe8) == 0x80)) {
     out_info("Fix DID/VID bug...");
     tis_access(TIS_LOCALITY_0, 0);
   }
 
-  switch (id->did_vid) {
+  switch (TIS_READ(id->did_vid)) {
   case 0x2e4d5453: /* "STM." */
   case 0x4a100000:
   case 0x104a: // Lenovo deskop
-    out_description("STM rev:", id->rid);
+    out_description("STM rev:", TIS_READ(id->rid));
     return TIS_INIT_STM;
   case 0xb15d1:
-    out_description("Infineon rev:", id->rid);
+    out_description("Infineon rev:", TIS_READ(id->rid));
     return TIS_INIT_INFINEON;
   case 0x32021114:
   case 0x32031114:
-    out_description("Atmel rev:", id->rid);
+    out_description("Atmel rev:", TIS_READ(id->rid));
     return TIS_INIT_ATMEL;
   case 0x100214E4:
-    out_description("Broadcom rev:", id->rid);
+    out_description("Broadcom rev:", TIS_READ(id->rid));
     return TIS_INIT_BROADCOM;
   case 0x10001:
-    out_description("Qemu TPM rev:", id->rid);
+    out_description("Qemu TPM rev:", TIS_READ(id->rid));
     return TIS_INIT_QEMU;
   case 0x11014:
-    out_description("IBM TPM rev:", id->rid);
+    out_description("IBM TPM rev:", TIS_READ(id->rid));
     return TIS_INIT_IBM;
   case 0:
   case -1:
     out_info("TPM not found!");
     return TIS_INIT_NO_TPM;
   default:
-    out_description("TPM unknown! ID:", id->did_vid);
+    out_description("TPM unknown! ID:", TIS_READ(id->did_vid));
     return TIS_INIT_NO_TPM;
   }
 }
 
+/**
+ * Returns the TSC value after the given number of microseconds.
+ */
+static unsigned long long tis_deadline(unsigned int us) {
+  return rdtsc() + (unsigned long long)us * tis_tsc_per_us;
+}
+
+/**
+ * Once tis_backoff() halts instead of spinning, acknowledge the state changes
+ * before the status is polled. A change after the poll raises an interrupt
+ * again, which the halt that follows does not miss.
+ */
+static void tis_irq_ack(unsigned int delay) {
+#ifdef TIS_IRQ
+  if (tis_irq && delay >= 64) {
+    volatile struct TIS_MMAP *mmap = (struct TIS_MMAP *)tis_locality;
+    TIS_WRITE(mmap->int_status, TIS_READ(mmap->int_status));
+    tis_mmio_count += 2;
+  }
+#endif
+}
+
+/**
+ * Delay the next poll. The delay starts with a microsecond and doubles up to
+ * a millisecond, so that a fast TPM is seen at once and a slow command is
+ * not polled too often. Returns false if the deadline has passed.
+ */
+static bool tis_backoff(unsigned long long deadline, unsigned int *delay) {
+  unsigned long long now = rdtsc();
+  if (now >= deadline)
+    return false;
+#ifdef TIS_IRQ
+  if (tis_irq && *delay >= 64) {
+    // tis_irq_ack() ran before the poll, sleep until the next state change
+    irq_wait(*delay);
+    if (*delay < 50000)
+      *delay <<= 1;
+    return true;
+  }
+#endif
+  unsigned long long until = tis_deadline(*delay);
+  if (until > deadline)
+    until = deadline;
+  while (rdtsc() < until)
+    asm volatile("pause");
+  if (*delay < 1000)
+    *delay <<= 1;
+  return true;
+}
+
+/**
+ * Poll a register until all bits of mask are set or the TSC passed the
+ * deadline. Returns true if the bits are set.
+ */
+static bool tis_wait_until(volatile unsigned char *reg, unsigned char mask,
+                           unsigned long long deadline) {
+  unsigned int delay = 1;
+  do {
+    tis_irq_ack(delay);
+    tis_mmio_count++;
+    if ((TIS_READ(*reg) & mask) == mask)
+      return true;
+  } while (tis_backoff(deadline, &delay));
+  return false;
+}
+
+/**
+ * Like tis_wait_until(), with a timeout in microseconds.
+ */
+static bool tis_wait(volatile unsigned char *reg, unsigned char mask,
+                     unsigned int timeout) {
+  return tis_wait_until(reg, mask, tis_deadline(timeout));
+}
+
 /* EXCEPT: ERROR_TIS_LOCALITY_DEACTIVATE
  *
  * Deactivate all localities.
@@ -94,11 +404,14 @@ RESULT tis_deactivate_all(void) {
   RESULT ret = {.exception.error = NONE};
   int res = 0;
   unsigned i;
+#ifdef TIS_IRQ
+  tis_irq_disable();
+#endif
   for (i = 0; i < 4; i++) {
     volatile struct TIS_MMAP *mmap = (struct TIS_MMAP *)(TIS_BASE + (i << 12));
-    if (mmap->access != 0xff) {
-      mmap->access = TIS_ACCESS_ACTIVE;
-      res |= mmap->access & TIS_ACCESS_ACTIVE;
+    if (TIS_READ(mmap->access) != 0xff) {
+      TIS_WRITE(mmap->access, TIS_ACCESS_ACTIVE);
+      res |= TIS_READ(mmap->access) & TIS_ACCESS_ACTIVE;
     }
   }
   ERROR(res, ERROR_TIS_LOCALITY_DEACTIVATE, "tis deactivate failed");
@@ -122,40 +435,131 @@ RESULT tis_access(enum TIS_LOCALITY locality, int force) {
   ASSERT(locality != TIS_LOCALITY_0 || !force);
   ASSERT(locality >= TIS_LOCALITY_0 && locality <= TIS_LOCALITY_4);
 
+#ifdef TIS_IRQ
+  tis_irq_disable();
+#endif
   tis_locality = TIS_BASE + locality;
   mmap = (struct TIS_MMAP *)tis_locality;
 
-  ERROR(!(mmap->access & TIS_ACCESS_VALID), ERROR_TIS_LOCALITY_REGISTER_INVALID,
-        "access register not valid");
-  ERROR(mmap->access == 0xff, ERROR_TIS_LOCALITY_REGISTER_INVALID,
+  ERROR(!(TIS_READ(mmap->access) & TIS_ACCESS_VALID),
+        ERROR_TIS_LOCALITY_REGISTER_INVALID, "access register not valid");
+  ERROR(TIS_READ(mmap->access) == 0xff, ERROR_TIS_LOCALITY_REGISTER_INVALID,
         "access register invalid")
-  ERROR(mmap->access & TIS_ACCESS_ACTIVE, ERROR_TIS_LOCALITY_ALREADY_ACCESSED,
-        "locality already active");
-
-  // first try it the normal way
-  mmap->access = TIS_ACCESS_REQUEST;
+  ERROR(TIS_READ(mmap->access) & TIS_ACCESS_ACTIVE,
+        ERROR_TIS_LOCALITY_ALREADY_ACCESSED, "locality already active");
 
-  wait(10);
+  // first try it the normal way, but do not wait long before seizing it
+  TIS_WRITE(mmap->access, TIS_ACCESS_REQUEST);
+  tis_wait(&mmap->access, TIS_ACCESS_ACTIVE,
+           force ? 10000 : tis_timeouts[TIS_TIMEOUT_A]);
 
   // make the tpm ready -> abort a command
-  mmap->sts_base = TIS_STS_CMD_READY;
+  TIS_WRITE(mmap->sts_base, TIS_STS_CMD_READY);
 
-  if (force && !(mmap->access & TIS_ACCESS_ACTIVE)) {
+  if (force && !(TIS_READ(mmap->access) & TIS_ACCESS_ACTIVE)) {
     // now force it
-    mmap->access = TIS_ACCESS_TO_SEIZE;
-    wait(10);
+    TIS_WRITE(mmap->access, TIS_ACCESS_TO_SEIZE);
+    tis_wait(&mmap->access, TIS_ACCESS_ACTIVE, tis_timeouts[TIS_TIMEOUT_A]);
     // make the tpm ready -> abort a command
-    mmap->sts_base = TIS_STS_CMD_READY;
+    TIS_WRITE(mmap->sts_base, TIS_STS_CMD_READY);
   }
-  ERROR(!(mmap->access & TIS_ACCESS_ACTIVE), ERROR_TIS_LOCALITY_ACCESS_TIMEOUT,
-        "TIS access timed out");
+  ERROR(!(TIS_READ(mmap->access) & TIS_ACCESS_ACTIVE),
+        ERROR_TIS_LOCALITY_ACCESS_TIMEOUT, "TIS access timed out");
+
+  // TIS 1.3 allows wider FIFO accesses if the transfer size is not legacy
+  unsigned int cap = TIS_READ(mmap->intf_capability);
+  tis_fifo_dword =
+      ((cap >> TIS_INTF_VERSION_SHIFT) & TIS_INTF_VERSION_MASK) >=
+          TIS_INTF_VERSION_1_3 &&
+      ((cap >> TIS_INTF_TRANSFER_SIZE_SHIFT) & TIS_INTF_TRANSFER_SIZE_MASK);
+#ifdef TIS_IRQ
+  tis_irq_enable(mmap);
+#endif
   return ret;
 }
 
-static void wait_state(volatile struct TIS_MMAP *mmap, unsigned char state) {
-  unsigned i;
-  for (i = 0; i < 4000 && (mmap->sts_base & state) != state; i++)
-    wait(1);
+static unsigned char tis_sts(volatile struct TIS_MMAP *mmap) {
+  tis_mmio_count++;
+  return TIS_READ(mmap->sts_base);
+}
+
+static void wait_state(volatile struct TIS_MMAP *mmap, unsigned char state,
+                       enum TIS_TIMEOUT timeout) {
+  tis_wait(&mmap->sts_base, state, tis_timeouts[timeout]);
+}
+
+/**
+ * Returns the duration class of a command ordinal. Commands that are not
+ * known to be short or medium are treated as long ones.
+ */
+static enum TIS_TIMEOUT tis_ordinal_duration(UINT32 ordinal) {
+  switch (ordinal) {
+  case TPM_ORD_OIAP:
+  case TPM_ORD_OSAP:
+  case TPM_ORD_PcrRead:
+  case TPM_ORD_GetCapability:
+  case TPM_ORD_Startup:
+  case TPM_ORD_FlushSpecific:
+    return TIS_DURATION_SHORT;
+  case TPM_ORD_Extend:
+  case TPM_ORD_GetRandom:
+  case TPM_ORD_NV_ReadValue:
+  case TPM_ORD_NV_WriteValueAuth:
+    return TIS_DURATION_MEDIUM;
+  default:
+    return TIS_DURATION_LONG;
+  }
+}
+
+/**
+ * Returns the number of bytes the FIFO accepts or delivers without further
+ * status checks, or zero if the TPM did not provide a burst in time.
+ */
+static unsigned tis_burst_count(volatile struct TIS_MMAP *mmap) {
+  volatile unsigned char *burst =
+      (volatile unsigned char *)&mmap->sts_burst_count;
+  unsigned long long deadline = tis_deadline(tis_timeouts[TIS_TIMEOUT_D]);
+  unsigned int delay = 1;
+  unsigned count;
+
+  // the burst count is not aligned, so read it bytewise
+  do {
+    tis_irq_ack(delay);
+    tis_mmio_count += 2;
+    count = TIS_READ(burst[0]) | TIS_READ(burst[1]) << 8;
+  } while (!count && tis_backoff(deadline, &delay));
+  return count;
+}
+
+static void tis_fifo_write(volatile struct TIS_MMAP *mmap,
+                           const unsigned char *in, unsigned n) {
+  if (tis_fifo_dword)
+    for (; n >= 4; n -= 4, in += 4) {
+      TIS_WRITE(*(volatile unsigned int *)&mmap->data_fifo,
+                in[0] | in[1] << 8 | in[2] << 16 | (unsigned)in[3] << 24);
+      tis_mmio_count++;
+    }
+  for (; n; n--, in++) {
+    TIS_WRITE(mmap->data_fifo, *in);
+    tis_mmio_count++;
+  }
+}
+
+static void tis_fifo_read(volatile struct TIS_MMAP *mmap, unsigned char *out,
+                          unsigned n) {
+  if (tis_fifo_dword)
+    for (; n >= 4; n -= 4, out += 4) {
+      unsigned int v = TIS_READ(*(volatile unsigned int *)&mmap->data_fifo);
+      out[0] = v;
+      out[1] = v >> 8;
+      out[2] = v >> 16;
+      out[3] = v >> 24;
+      tis_mmio_count++;
+    }
+  for (; n; n--, out++) {
+    *out = TIS_READ(mmap->data_fifo);
+    tis_mmio_count++;
+  }
 }
 
 /**
@@ -170,26 +574,51 @@ static RESULT_(int) tis_write(void) {
   const unsigned char *in = tis_buffers.in;
   const TPM_COMMAND_HEADER *header = (const TPM_COMMAND_HEADER *)tis_buffers.in;
 
-  if (!(mmap->sts_base & TIS_STS_CMD_READY)) {
+  TRACE(
+      tis_trace_begin(htonl(header->ordinal), htonl(header->paramSize)));
+  unsigned long long busy = 0;
+  if (tis_detached.deadline) {
+    if (tis_detached.locality == tis_locality)
+      // its response shows that it is done, it is dropped below
+      tis_wait_until(&mmap->sts_base, TIS_STS_VALID | TIS_STS_DATA_AVAIL,
+                     tis_detached.deadline);
+    else
+      // its locality was released, the TPM gets ready when it is done
+      busy = tis_detached.deadline;
+    tis_detached.deadline = 0;
+  }
+  if (!(tis_sts(mmap) & TIS_STS_CMD_READY)) {
     // make the tpm ready -> wakeup from idle state
-    mmap->sts_base = TIS_STS_CMD_READY;
-    wait_state(mmap, TIS_STS_CMD_READY);
+    TIS_WRITE(mmap->sts_base, TIS_STS_CMD_READY);
+    tis_mmio_count++;
+    unsigned long long ready = tis_deadline(tis_timeouts[TIS_TIMEOUT_B]);
+    tis_wait_until(&mmap->sts_base, TIS_STS_CMD_READY,
+                   busy > ready ? busy : ready);
   }
-  ERROR(!(mmap->sts_base & TIS_STS_CMD_READY), ERROR_TIS_TRANSMIT,
+  ERROR(!(tis_sts(mmap) & TIS_STS_CMD_READY), ERROR_TIS_TRANSMIT,
         "tis_write() not ready");
 
+  // write whole bursts without checking the status in between
   int size = htonl(header->paramSize);
-  for (ret.value = 0; ret.value < size; ret.value++) {
-    mmap->data_fifo = *in;
-    in++;
+  ERROR(size > TIS_BUFFER_SIZE, ERROR_TIS_TRANSMIT, "command too large");
+  for (ret.value = 0; ret.value < size;) {
+    unsigned burst = tis_burst_count(mmap);
+    ERROR(!burst, ERROR_TIS_TRANSMIT, "no burst count");
+    if (burst > size - ret.value)
+      burst = size - ret.value;
+    tis_fifo_write(mmap, in + ret.value, burst);
+    ret.value += burst;
   }
 
-  wait_state(mmap, TIS_STS_VALID);
-  ERROR(mmap->sts_base & TIS_STS_EXPECT, ERROR_TIS_TRANSMIT,
+  wait_state(mmap, TIS_STS_VALID, TIS_TIMEOUT_C);
+  ERROR(tis_sts(mmap) & TIS_STS_EXPECT, ERROR_TIS_TRANSMIT,
         "TPM expects more data");
 
   // execute the command
-  mmap->sts_base = TIS_STS_TPM_GO;
+  tis_duration = tis_ordinal_duration(htonl(header->ordinal));
+  TIS_WRITE(mmap->sts_base, TIS_STS_TPM_GO);
+  tis_mmio_count++;
+  TRACE(tis_trace_lap(TIS_TRACE_WRITE, 0));
 
   return ret;
 }
@@ -206,26 +635,84 @@ static RESULT_(int) tis_read(void) {
   unsigned char *out = tis_buffers.out;
   TPM_COMMAND_HEADER *header = (TPM_COMMAND_HEADER *)tis_buffers.out;
 
-  wait_state(mmap, TIS_STS_VALID | TIS_STS_DATA_AVAIL);
-  ERROR(!(mmap->sts_base & TIS_STS_VALID), ERROR_TIS_TRANSMIT, "sts not valid");
-
-  for (ret.value = 0; ret.value < sizeof(TPM_COMMAND_HEADER) &&
-                      mmap->sts_base & TIS_STS_DATA_AVAIL;
-       ret.value++) {
-    *out = mmap->data_fifo;
-    out++;
-  }
-  int size = htonl(header->paramSize);
-  for (; ret.value < size && mmap->sts_base & TIS_STS_DATA_AVAIL; ret.value++) {
-    *out = mmap->data_fifo;
-    out++;
+  wait_state(mmap, TIS_STS_VALID | TIS_STS_DATA_AVAIL, tis_duration);
+  TRACE(tis_trace_lap(TIS_TRACE_EXECUTE, 0));
+  ERROR(!(tis_sts(mmap) & TIS_STS_VALID), ERROR_TIS_TRANSMIT, "sts not valid");
+
+  // read the header first, then the rest, a whole burst at a time
+  int size = sizeof(TPM_COMMAND_HEADER);
+  for (ret.value = 0;
+       ret.value < size && tis_sts(mmap) & TIS_STS_DATA_AVAIL;) {
+    unsigned burst = tis_burst_count(mmap);
+    ERROR(!burst, ERROR_TIS_TRANSMIT, "no burst count");
+    if (burst > size - ret.value)
+      burst = size - ret.value;
+    tis_fifo_read(mmap, out + ret.value, burst);
+    ret.value += burst;
+    if (ret.value == sizeof(TPM_COMMAND_HEADER)) {
+      size = htonl(header->paramSize);
+      ERROR(size > TIS_BUFFER_SIZE, ERROR_TIS_TRANSMIT, "response too large");
+    }
   }
+  // the rest of tis_buffers.out is still the last response
+  ERROR(ret.value < size, ERROR_TIS_TRANSMIT, "short response");
 
-  ERROR(mmap->sts_base & TIS_STS_DATA_AVAIL, ERROR_TIS_TRANSMIT,
+  ERROR(tis_sts(mmap) & TIS_STS_DATA_AVAIL, ERROR_TIS_TRANSMIT,
         "more data available");
 
   // make the tpm ready again -> this allows tpm background jobs to complete
-  mmap->sts_base = TIS_STS_CMD_READY;
+  TIS_WRITE(mmap->sts_base, TIS_STS_CMD_READY);
+  tis_mmio_count++;
+  TRACE(tis_trace_lap(TIS_TRACE_READ, ret.value));
+  return ret;
+}
+
+/**
+ * EXCEPT: ERROR_TIS_TRANSMIT
+ *
+ * Send the command in tis_buffers.in to the TPM and start it, but do not wait
+ * for the response. The input buffer may be reused as soon as this returns.
+ */
+RESULT tis_submit(void) {
+  RESULT ret = {.exception.error = NONE};
+
+  tis_mmio_count = 0;
+  RESULT_(int) res = tis_write();
+  THROW(res.exception);
+
+  return ret;
+}
+
+/**
+ * Leave the submitted command running without reading its response. Its
+ * duration starts now, the next command waits for the rest of it.
+ */
+void tis_detach(void) {
+  tis_detached.locality = tis_locality;
+  tis_detached.deadline = tis_deadline(tis_timeouts[tis_duration]);
+}
+
+/**
+ * Returns true if the response of the submitted command is available.
+ */
+bool tis_poll(void) {
+  volatile struct TIS_MMAP *mmap = (struct TIS_MMAP *)tis_locality;
+  unsigned char state = TIS_STS_VALID | TIS_STS_DATA_AVAIL;
+  return (tis_sts(mmap) & state) == state;
+}
+
+/**
+ * EXCEPT: ERROR_TIS_TRANSMIT
+ *
+ * Wait for the response of the submitted command and read it into
+ * tis_buffers.out.
+ */
+RESULT tis_complete(void) {
+  RESULT ret = {.exception.error = NONE};
+
+  RESULT_(int) res = tis_read();
+  THROW(res.exception);
+
   return ret;
 }
 
@@ -235,12 +722,11 @@ static RESULT_(int) tis_read(void) {
  */
 RESULT tis_transmit(void) {
   RESULT ret = {.exception.error = NONE};
-  RESULT_(int) res;
 
-  res = tis_write();
-  THROW(res.exception);
-  res = tis_read();
-  THROW(res.exception);
+  RESULT submit_ret = tis_submit();
+  THROW(submit_ret.exception);
+  RESULT complete_ret = tis_complete();
+  THROW(complete_ret.exception);
 
   return ret;
 }
@@ -13,6 +13,7 @@
  */
 
 #ifndef ISABELLE
+#include "asm.h"
 #include "alloc.h"
 #include "heap.h"
 #include "tis.h"
@@ -21,227 +22,498 @@
 #include "util.h"
 #include "tpm.h"
 
-RESULT TPM_Startup(TPM_STARTUP_TYPE startupType_in) {
-  RESULT ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
+/*
+ * Shadow of the PCRs SABLE reads after the late launch. Each is read from the
+ * TPM only once, afterwards it follows the values that TPM_Extend returns.
+ */
+#define PCR_SHADOW_FIRST 17
+#define PCR_SHADOW_COUNT 3
+static struct {
+  TPM_PCRVALUE value[PCR_SHADOW_COUNT];
+  BYTE valid;
+} pcr_shadow;
+
+/* The PCR of the extend in flight */
+static TPM_PCRINDEX extend_pcr;
+
+static void pcr_shadow_set(TPM_PCRINDEX pcr, TPM_PCRVALUE value) {
+  unsigned slot = pcr - PCR_SHADOW_FIRST;
+  if (slot < PCR_SHADOW_COUNT) {
+    pcr_shadow.value[slot] = value;
+    pcr_shadow.valid |= 1 << slot;
+  }
+}
 
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(TPM_STARTUP_TYPE);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_Startup;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
 
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
+/*
+ * The commands are described by tables of their parameters, which
+ * tpm_submit() and tpm_complete() marshal in turn. A parameter is one byte,
+ * its type and whether it is part of the param digest of an authorized
+ * command. The request takes its parameters from an array of TPM_ARG, the
+ * response stores them through an array of pointers, one per parameter.
+ */
+enum TPM_PARAM {
+  P_END,
+  P_UINT16,
+  P_UINT32,
+  P_NONCE,       // 20 bytes, also a digest or an encAuth
+  P_SIZED,       // a UINT32 size and the data of a HEAP_DATA
+  P_PCR_INFO,    // a UINT32 size and a TPM_PCR_INFO_LONG
+  P_STORED_DATA, // a TPM_STORED_DATA12
+  P_VIEW,        // the data of a DATA_VIEW, after its UINT32 size if out
+  P_TYPE = 0x7f,
+  P_HASHED = 0x80,
+};
+
+/* A command, its parameters are terminated by P_END */
+#define TPM_MAX_PARAMS 5
+
+struct tpm_command {
+  TPM_COMMAND_CODE ordinal;
+  BYTE in[TPM_MAX_PARAMS];
+  BYTE out[TPM_MAX_PARAMS];
+};
+
+typedef union {
+  UINT32 value;
+  const void *ptr;
+} TPM_ARG;
+
+/* An authorization session of a command and its secret */
+struct tpm_auth {
+  TPM_SESSION **session;
+  const BYTE *secret;
+  HMAC_Key key;
+};
+
+static const struct tpm_command tpm_cmd_startup = {
+    TPM_ORD_Startup, {P_UINT16}};
+static const struct tpm_command tpm_cmd_continue_self_test = {
+    TPM_ORD_ContinueSelfTest, {P_END}};
+static const struct tpm_command tpm_cmd_get_random = {
+    TPM_ORD_GetRandom, {P_UINT32}, {P_SIZED}};
+/* capArea, subCapSize and subCap */
+static const struct tpm_command tpm_cmd_get_capability = {
+    TPM_ORD_GetCapability, {P_UINT32, P_UINT32, P_UINT32}, {P_SIZED}};
+static const struct tpm_command tpm_cmd_pcr_read = {
+    TPM_ORD_PcrRead, {P_UINT32}, {P_NONCE}};
+static const struct tpm_command tpm_cmd_extend = {
+    TPM_ORD_Extend, {P_UINT32, P_NONCE}, {P_NONCE}};
+static const struct tpm_command tpm_cmd_oiap = {
+    TPM_ORD_OIAP, {P_END}, {P_UINT32, P_NONCE}};
+static const struct tpm_command tpm_cmd_osap = {
+    TPM_ORD_OSAP, {P_UINT16, P_UINT32, P_NONCE}, {P_UINT32, P_NONCE, P_NONCE}};
+static const struct tpm_command tpm_cmd_nv_write_value_auth = {
+    TPM_ORD_NV_WriteValueAuth,
+    {P_UINT32 | P_HASHED, P_UINT32 | P_HASHED, P_SIZED | P_HASHED}};
+static const struct tpm_command tpm_cmd_nv_read_value = {
+    TPM_ORD_NV_ReadValue,
+    {P_UINT32 | P_HASHED, P_UINT32 | P_HASHED, P_UINT32 | P_HASHED},
+    {P_VIEW | P_HASHED}};
+/* inData is a marshalled TPM_STORED_DATA12 */
+static const struct tpm_command tpm_cmd_unseal = {
+    TPM_ORD_Unseal, {P_UINT32, P_VIEW | P_HASHED}, {P_SIZED | P_HASHED}};
+static const struct tpm_command tpm_cmd_seal = {
+#ifdef USE_TPM_SEALX
+    TPM_ORD_Sealx,
+#else
+    TPM_ORD_Seal,
+#endif
+    {P_UINT32, P_NONCE | P_HASHED, P_PCR_INFO | P_HASHED, P_SIZED | P_HASHED},
+    {P_STORED_DATA | P_HASHED}};
 
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
-  marshal_UINT16(startupType_in, &pctx, NULL);
+/**
+ * Forget *session, which the TPM does not keep anymore, and free its memory.
+ */
+static void tpm_session_drop(TPM_SESSION **session) {
+  TPM_SESSION *s = *session;
+  *session = NULL;
+  if (s) {
+    dealloc(heap, s->osap);
+    dealloc(heap, s);
+  }
+}
 
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
+/**
+ * Marshal the command with its parameters in into tis_buffers.in and compute
+ * their inParamDigest into sctx if it has sessions. This does not depend on
+ * the nonces of the sessions, so it may run while the TPM executes the
+ * previous command.
+ */
+static void tpm_marshal(const struct tpm_command *cmd, const TPM_ARG *in,
+                        unsigned int sessions, Pack_Context *pctx,
+                        SHA1_Context *sctx) {
+  SHA1_Context *digest = sessions ? sctx : NULL;
+
+  pack_init(pctx, tis_buffers.in, sizeof(tis_buffers.in));
+  if (digest)
+    sha1_init(digest); // compute inParamDigest
+  marshal_UINT16(TPM_TAG_RQU_COMMAND + sessions, pctx, NULL);
+  marshal_UINT32(0, pctx, NULL);              // paramSize, see below
+  marshal_UINT32(cmd->ordinal, pctx, digest); // 1S
+  for (const BYTE *p = cmd->in; *p; p++, in++) {
+    SHA1_Context *s = *p & P_HASHED ? digest : NULL; // 2S...
+    switch (*p & P_TYPE) {
+    case P_UINT16:
+      marshal_UINT16(in->value, pctx, s);
+      break;
+    case P_UINT32:
+      marshal_UINT32(in->value, pctx, s);
+      break;
+    case P_NONCE:
+      marshal_array(in->ptr, sizeof(TPM_NONCE), pctx, s);
+      break;
+    case P_SIZED: {
+      const HEAP_DATA *data = in->ptr;
+      marshal_UINT32(data->dataSize, pctx, s);
+      marshal_array(data->data, data->dataSize, pctx, s);
+      break;
+    }
+    case P_PCR_INFO:
+      marshal_UINT32(sizeof_TPM_PCR_INFO_LONG(in->ptr), pctx, s);
+      marshal_TPM_PCR_INFO_LONG(in->ptr, pctx, s);
+      break;
+    case P_STORED_DATA:
+      marshal_TPM_STORED_DATA12(in->ptr, pctx, s);
+      break;
+    case P_VIEW: {
+      const DATA_VIEW *view = in->ptr;
+      marshal_array(view->data, view->dataSize, pctx, s);
+      break;
+    }
+    }
+  }
+  if (digest)
+    sha1_finish(digest); // inParamDigest = sctx->hash
+}
 
-  RESULT transmit_ret = tis_transmit();
-  THROW(transmit_ret.exception);
+/**
+ * EXCEPT: ERROR_TIS_TRANSMIT
+ *
+ * Append an authorization for each of the sessions to the command that
+ * tpm_marshal() left in pctx and sctx, and start it.
+ */
+static RESULT tpm_authorize(Pack_Context *pctx, const SHA1_Context *sctx,
+                            struct tpm_auth *auth, unsigned int sessions) {
+  RESULT ret = {.exception.error = NONE};
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
+  for (unsigned int i = 0; i < sessions; i++) {
+    TPM_SESSION *session = *auth[i].session;
+    HMAC_Context hctx;
+
+    hmac_key(&auth[i].key, auth[i].secret, sizeof(TPM_SECRET));
+    hmac_start(&hctx, &auth[i].key); // compute inAuth
+    marshal_array(&sctx->hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H
+    marshal_UINT32(session->authHandle, pctx, NULL);                  //
+    marshal_array(&session->nonceEven, sizeof(TPM_NONCE), NULL,       // 2H
+                  &hctx.sctx);                                        // 2H
+    marshal_array(&session->nonceOdd, sizeof(TPM_NONCE), pctx,        // 3H
+                  &hctx.sctx);                                        // 3H
+    marshal_BYTE(session->continueAuthSession, pctx, &hctx.sctx);     // 4H
+    hmac_finish(&hctx); // inAuth = hctx.sctx.hash
+    marshal_array(&hctx.sctx.hash, sizeof(TPM_DIGEST), pctx, NULL);
+  }
 
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
+  // the size is only known now
+  *(UINT32 *)(tis_buffers.in + sizeof(TPM_TAG)) = htonl(pack_finish(pctx));
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
+  RESULT submit_ret = tis_submit();
+  THROW(submit_ret.exception);
 
   return ret;
 }
 
-RESULT TPM_GetRandom(BYTE *randomBytes_out /* out */,
-                     UINT32 bytesRequested_in) {
+/**
+ * EXCEPT: ERROR_TIS_TRANSMIT
+ *
+ * Marshal the command with its parameters in and an authorization for each
+ * of the sessions into tis_buffers.in, and start it.
+ */
+static RESULT tpm_submit(const struct tpm_command *cmd, const TPM_ARG *in,
+                         struct tpm_auth *auth, unsigned int sessions) {
+  Pack_Context pctx;
+  SHA1_Context sctx;
+
+  tpm_marshal(cmd, in, sessions, &pctx, &sctx);
+  return tpm_authorize(&pctx, &sctx, auth, sessions);
+}
+
+/**
+ * EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ * ERROR_TPM_BAD_OUTPUT_AUTH
+ *
+ * Read the response of the command started by tpm_submit(), store its
+ * parameters through out and check the authorization of each session. A
+ * session that the TPM closed is freed and set to NULL.
+ */
+static RESULT tpm_complete(const struct tpm_command *cmd, void *const *out,
+                           struct tpm_auth *auth, unsigned int sessions) {
   RESULT ret = {.exception.error = NONE};
   TPM_RESULT res;
-  Pack_Context pctx;
   Unpack_Context uctx;
-
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(UINT32);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_GetRandom;
+  SHA1_Context sctx;
+  SHA1_Context *digest = sessions ? &sctx : NULL;
   TPM_TAG tag_out;
   UINT32 paramSize_out;
-  UINT32 randomBytesSize_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
+  UINT32 ordinal = cmd->ordinal;
+  bool bad_auth = false;
 
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
-  marshal_UINT32(bytesRequested_in, &pctx, NULL);
-
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
-  THROW(transmit_ret.exception);
+  RESULT complete_ret = tis_complete();
+  THROW(complete_ret.exception);
 
   unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
 
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
-  unmarshal_UINT32(&randomBytesSize_out, &uctx, NULL);
-  ERROR(bytesRequested_in != randomBytesSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Did not get the requested number of random bytes");
-  unmarshal_array(randomBytes_out, randomBytesSize_out, &uctx, NULL);
+  if (digest)
+    sha1_init(digest);                           // compute outParamDigest
+  unmarshal_UINT16(&tag_out, &uctx, NULL);       //
+  unmarshal_UINT32(&paramSize_out, &uctx, NULL); //
+  unmarshal_UINT32(&res, &uctx, digest);         // 1S
+  TPM_ERROR(res);                                //
+  if (digest)                                    //
+    unmarshal_UINT32(&ordinal, NULL, digest);    // 2S
+  for (const BYTE *p = cmd->out; *p; p++, out++) {
+    SHA1_Context *s = *p & P_HASHED ? digest : NULL; // 3S...
+    switch (*p & P_TYPE) {
+    case P_UINT16:
+      unmarshal_UINT16(*out, &uctx, s);
+      break;
+    case P_UINT32:
+      unmarshal_UINT32(*out, &uctx, s);
+      break;
+    case P_NONCE:
+      unmarshal_array(*out, sizeof(TPM_NONCE), &uctx, s);
+      break;
+    case P_SIZED: {
+      // at most dataSize bytes, into data or onto the heap if it is NULL
+      HEAP_DATA *data = *out;
+      UINT32 size;
+      unmarshal_UINT32(&size, &uctx, s);
+      ERROR(size > data->dataSize, ERROR_TPM_BAD_OUTPUT_PARAM,
+            "Bad size of the output data");
+      data->dataSize = size;
+      if (data->data)
+        unmarshal_array(data->data, size, &uctx, s);
+      else
+        unmarshal_ptr(&data->data, size, &uctx, s);
+      break;
+    }
+    case P_STORED_DATA:
+      unmarshal_TPM_STORED_DATA12(*out, &uctx, s);
+      break;
+    case P_VIEW: {
+      // at most dataSize bytes, left in tis_buffers.out
+      DATA_VIEW *view = *out;
+      UINT32 size;
+      unmarshal_UINT32(&size, &uctx, s);
+      ERROR(size > view->dataSize, ERROR_TPM_BAD_OUTPUT_PARAM,
+            "Bad size of the output data");
+      const BYTE *data;
+      unmarshal_view(&data, size, &uctx, s);
+      *view = (DATA_VIEW){size, data};
+      break;
+    }
+    }
+  }
+  if (digest)
+    sha1_finish(digest); // outParamDigest = sctx.hash
+
+  for (unsigned int i = 0; i < sessions; i++) {
+    TPM_SESSION *session = *auth[i].session;
+    HMAC_Context hctx;
+    TPM_AUTHDATA resAuth_out;
+
+    hmac_start(&hctx, &auth[i].key); // compute HM
+    unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H
+    unmarshal_array(&session->nonceEven, sizeof(TPM_NONCE), &uctx,     // 2H
+                    &hctx.sctx);                                       // 2H
+    unmarshal_array(&session->nonceOdd, sizeof(TPM_NONCE), NULL,       // 3H
+                    &hctx.sctx);                                       // 3H
+    unmarshal_BYTE(&session->continueAuthSession, &uctx, &hctx.sctx);  // 4H
+    unmarshal_array(&resAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);  //
+    hmac_finish(&hctx); // HM = hctx.sctx.hash
+
+    bad_auth |= !!memcmp(&hctx.sctx.hash, &resAuth_out, sizeof(TPM_AUTHDATA));
+    if (!session->continueAuthSession)
+      tpm_session_drop(auth[i].session);
+  }
 
   UINT32 bytes_unpacked = unpack_finish(&uctx);
   ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
         "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
+  ERROR(tag_out != TPM_TAG_RSP_COMMAND + sessions, ERROR_TPM_BAD_OUTPUT_PARAM,
         "Bad tag_out");
+  ERROR(bad_auth, ERROR_TPM_BAD_OUTPUT_AUTH, "Bad output auth");
 
   return ret;
 }
 
-RESULT_(TPM_PCRVALUE) TPM_PCRRead(TPM_PCRINDEX pcrIndex_in) {
-  RESULT_(TPM_PCRVALUE) ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
+/**
+ * Transmit a command and wait for its response, see tpm_submit() and
+ * tpm_complete().
+ */
+static RESULT tpm_transmit(const struct tpm_command *cmd, const TPM_ARG *in,
+                           void *const *out, struct tpm_auth *auth,
+                           unsigned int sessions) {
+  RESULT ret = {.exception.error = NONE};
 
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(TPM_PCRINDEX);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_PcrRead;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
+  RESULT submit_ret = tpm_submit(cmd, in, auth, sessions);
+  THROW(submit_ret.exception);
+  RESULT complete_ret = tpm_complete(cmd, out, auth, sessions);
+  THROW(complete_ret.exception);
+
+  return ret;
+}
+
+RESULT TPM_Startup(TPM_STARTUP_TYPE startupType_in) {
+  const TPM_ARG in[] = {{startupType_in}};
+  return tpm_transmit(&tpm_cmd_startup, in, NULL, NULL, 0);
+}
 
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
+RESULT TPM_ContinueSelfTest_submit(void) {
+  RESULT ret = {.exception.error = NONE};
 
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
-  marshal_UINT32(pcrIndex_in, &pctx, NULL);
+  RESULT submit_ret = tpm_submit(&tpm_cmd_continue_self_test, NULL, NULL, 0);
+  THROW(submit_ret.exception);
+  tis_detach();
 
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
+  return ret;
+}
 
-  RESULT transmit_ret = tis_transmit();
+RESULT TPM_GetRandom(BYTE *randomBytes_out /* out */, UINT32 bytesRequested_in,
+                     UINT32 *randomBytesSize_out /* out */) {
+  RESULT ret = {.exception.error = NONE};
+  const TPM_ARG in[] = {{bytesRequested_in}};
+  HEAP_DATA random = {bytesRequested_in, randomBytes_out};
+  void *const out[] = {&random};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_get_random, in, out, NULL, 0);
   THROW(transmit_ret.exception);
+  *randomBytesSize_out = random.dataSize;
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
+  return ret;
+}
 
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
-  unmarshal_array(&ret.value, sizeof(TPM_PCRVALUE), &uctx, NULL);
+RESULT TPM_GetCapability(TPM_CAPABILITY_AREA capArea_in, UINT32 subCap_in,
+                         UINT32 *resp_out /* out */, UINT32 respCount_in) {
+  RESULT ret = {.exception.error = NONE};
+  const TPM_ARG in[] = {{capArea_in}, {sizeof(UINT32)}, {subCap_in}};
+  HEAP_DATA resp = {respCount_in * sizeof(UINT32), (BYTE *)resp_out};
+  void *const out[] = {&resp};
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
+  RESULT transmit_ret =
+      tpm_transmit(&tpm_cmd_get_capability, in, out, NULL, 0);
+  THROW(transmit_ret.exception);
+  ERROR(resp.dataSize != respCount_in * sizeof(UINT32),
+        ERROR_TPM_BAD_OUTPUT_PARAM, "Unexpected capability size");
+  for (UINT32 i = 0; i < respCount_in; i++)
+    resp_out[i] = ntohl(resp_out[i]);
 
   return ret;
 }
 
-RESULT_(TPM_PCRVALUE)
-TPM_Extend(TPM_PCRINDEX pcrNum_in, TPM_DIGEST inDigest_in) {
+RESULT_(TPM_PCRVALUE) TPM_PCRRead(TPM_PCRINDEX pcrIndex_in) {
   RESULT_(TPM_PCRVALUE) ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
+  const TPM_ARG in[] = {{pcrIndex_in}};
+  void *const out[] = {&ret.value};
 
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(TPM_PCRINDEX) +
-                        sizeof(TPM_DIGEST);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_Extend;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_pcr_read, in, out, NULL, 0);
+  THROW(transmit_ret.exception);
 
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
+  return ret;
+}
 
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
-  marshal_UINT32(pcrNum_in, &pctx, NULL);
-  marshal_array(&inDigest_in, sizeof(TPM_DIGEST), &pctx, NULL);
+/**
+ * Read a PCR from the shadow, or from the TPM if it is not shadowed yet.
+ * Debug builds always read the TPM and check the shadow against it.
+ */
+RESULT_(TPM_PCRVALUE) tpm_pcr_read(TPM_PCRINDEX pcrIndex_in) {
+  RESULT_(TPM_PCRVALUE) ret = {.exception.error = NONE};
+  unsigned slot = pcrIndex_in - PCR_SHADOW_FIRST;
+  bool shadowed =
+      slot < PCR_SHADOW_COUNT && (pcr_shadow.valid & 1 << slot);
+
+#ifdef NDEBUG
+  if (shadowed) {
+    ret.value = pcr_shadow.value[slot];
+    return ret;
+  }
+#endif
+  ret = TPM_PCRRead(pcrIndex_in);
+  THROW(ret.exception);
+#ifndef NDEBUG
+  ERROR(shadowed && memcmp(&pcr_shadow.value[slot], &ret.value,
+                           sizeof(TPM_PCRVALUE)),
+        ERROR_PCR_SHADOW, "PCR shadow differs from the TPM");
+#endif
+  pcr_shadow_set(pcrIndex_in, ret.value);
 
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
+  return ret;
+}
 
-  RESULT transmit_ret = tis_transmit();
-  THROW(transmit_ret.exception);
+RESULT TPM_Extend_submit(TPM_PCRINDEX pcrNum_in, TPM_DIGEST inDigest_in) {
+  const TPM_ARG in[] = {{pcrNum_in}, {.ptr = &inDigest_in}};
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
+  extend_pcr = pcrNum_in;
+  return tpm_submit(&tpm_cmd_extend, in, NULL, 0);
+}
 
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
-  unmarshal_array(&ret.value, sizeof(TPM_PCRVALUE), &uctx, NULL);
+RESULT_(TPM_PCRVALUE) TPM_Extend_complete(void) {
+  RESULT_(TPM_PCRVALUE) ret = {.exception.error = NONE};
+  void *const out[] = {&ret.value};
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
+  RESULT complete_ret = tpm_complete(&tpm_cmd_extend, out, NULL, 0);
+  THROW(complete_ret.exception);
 
+  pcr_shadow_set(extend_pcr, ret.value);
   return ret;
 }
 
-RESULT TPM_OIAP(TPM_SESSION **session) {
-  ASSERT(session);
-  RESULT ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
-
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in =
-      sizeof(TPM_TAG) + sizeof(UINT32) + sizeof(TPM_COMMAND_CODE);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_OIAP;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
+RESULT_(TPM_PCRVALUE)
+TPM_Extend(TPM_PCRINDEX pcrNum_in, TPM_DIGEST inDigest_in) {
+  RESULT_(TPM_PCRVALUE) ret = {.exception.error = NONE};
 
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
+  RESULT submit_ret = TPM_Extend_submit(pcrNum_in, inDigest_in);
+  THROW(submit_ret.exception);
 
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
+  return TPM_Extend_complete();
+}
 
-  RESULT transmit_ret = tis_transmit();
+RESULT TPM_OIAP(TPM_SESSION **session) {
+  ASSERT(session);
+  RESULT ret = {.exception.error = NONE};
+  // before the TPM opens a session that nothing could close
+  TPM_SESSION *s = alloc(heap, sizeof(TPM_SESSION));
+  ERROR(!s, ERROR_BUFFER_OVERFLOW, "no heap for the session");
+  void *const out[] = {&s->authHandle, &s->nonceEven};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_oiap, NULL, out, NULL, 0);
+  if (transmit_ret.exception.error)
+    dealloc(heap, s);
   THROW(transmit_ret.exception);
+  s->osap = NULL;
+  *session = s;
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
+  return ret;
+}
 
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
-  TPM_SESSION *s = *session = alloc(heap, sizeof(TPM_SESSION));
-  unmarshal_UINT32(&s->authHandle, &uctx, NULL);
-  unmarshal_array(&s->nonceEven, sizeof(TPM_NONCE), &uctx, NULL);
-  s->osap = NULL;
+/**
+ * Make *session ready for the next authorized command. An OIAP session is
+ * only started if *session is not open anymore, otherwise the nonceEven of
+ * the last response is used. The TPM closes the session with the command.
+ */
+RESULT tpm_session_oiap(TPM_SESSION **session, TPM_NONCE nonceOdd) {
+  ASSERT(session);
+  RESULT ret = {.exception.error = NONE};
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
+  if (!*session) {
+    RESULT oiap_ret = TPM_OIAP(session);
+    THROW(oiap_ret.exception);
+  }
+  (*session)->nonceOdd = nonceOdd;
+  (*session)->continueAuthSession = FALSE;
 
   return ret;
 }
@@ -250,52 +522,27 @@ RESULT TPM_OSAP(TPM_ENTITY_TYPE entityType_in, UINT32 entityValue_in,
                 TPM_NONCE nonceOddOSAP, TPM_SESSION **session) {
   ASSERT(session);
   RESULT ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
-
-  TPM_TAG tag_in = TPM_TAG_RQU_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(TPM_ENTITY_TYPE) +
-                        sizeof(UINT32) + sizeof(TPM_NONCE);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_OSAP;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
-
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, NULL);
-  marshal_UINT16(entityType_in, &pctx, NULL);
-  marshal_UINT32(entityValue_in, &pctx, NULL);
-  marshal_array(&nonceOddOSAP, sizeof(TPM_NONCE), &pctx, NULL);
-
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
+  // before the TPM opens a session that nothing could close
+  TPM_SESSION *s = alloc(heap, sizeof(TPM_SESSION));
+  TPM_OSAP_EXTENSION *osap = alloc(heap, sizeof(TPM_OSAP_EXTENSION));
+  if (!s || !osap) {
+    dealloc(heap, osap);
+    dealloc(heap, s);
+  }
+  ERROR(!s || !osap, ERROR_BUFFER_OVERFLOW, "no heap for the session");
+  const TPM_ARG in[] = {
+      {entityType_in}, {entityValue_in}, {.ptr = &nonceOddOSAP}};
+  void *const out[] = {&s->authHandle, &s->nonceEven, &osap->nonceEvenOSAP};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_osap, in, out, NULL, 0);
+  if (transmit_ret.exception.error) {
+    dealloc(heap, osap);
+    dealloc(heap, s);
+  }
   THROW(transmit_ret.exception);
-
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
-
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, NULL);
-  TPM_ERROR(res);
-  TPM_SESSION *s = *session = alloc(heap, sizeof(TPM_SESSION));
-  s->osap = alloc(heap, sizeof(TPM_OSAP_EXTENSION));
-  unmarshal_UINT32(&s->authHandle, &uctx, NULL);
-  unmarshal_array(&s->nonceEven, sizeof(TPM_NONCE), &uctx, NULL);
-  unmarshal_array(&s->osap->nonceEvenOSAP, sizeof(TPM_NONCE), &uctx, NULL);
-
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
-
-  s->osap->nonceOddOSAP = nonceOddOSAP;
+  osap->nonceOddOSAP = nonceOddOSAP;
+  s->osap = osap;
+  *session = s;
 
   return ret;
 }
@@ -304,312 +551,176 @@ RESULT TPM_NV_WriteValueAuth(const BYTE *data_in, UINT32 dataSize_in,
                              TPM_NV_INDEX nvIndex_in, UINT32 offset_in,
                              TPM_AUTHDATA nv_auth, TPM_SESSION **session) {
   ASSERT(session);
-  RESULT ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
-  SHA1_Context sctx;
-  HMAC_Context hctx;
-  TPM_SESSION *s = *session;
+  const HEAP_DATA data = {dataSize_in, (BYTE *)data_in};
+  const TPM_ARG in[] = {{nvIndex_in}, {offset_in}, {.ptr = &data}};
+  struct tpm_auth auth = {session, nv_auth.authdata};
 
-  TPM_TAG tag_in = TPM_TAG_RQU_AUTH1_COMMAND;
-  UINT32 paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) +
-                        sizeof(TPM_COMMAND_CODE) + sizeof(TPM_NV_INDEX) +
-                        sizeof(UINT32) + sizeof(UINT32) + dataSize_in +
-                        sizeof(TPM_AUTHHANDLE) + sizeof(TPM_NONCE) +
-                        sizeof(TPM_BOOL) + sizeof(TPM_AUTHDATA);
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_NV_WriteValueAuth;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-  TPM_AUTHDATA resAuth_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
-
-  sha1_init(&sctx);                                  // compute inParamDigest
-  marshal_UINT16(tag_in, &pctx, NULL);               //
-  marshal_UINT32(paramSize_in, &pctx, NULL);         //
-  marshal_UINT32(ordinal_in, &pctx, &sctx);          // 1S
-  marshal_UINT32(nvIndex_in, &pctx, &sctx);          // 2S
-  marshal_UINT32(offset_in, &pctx, &sctx);           // 3S
-  marshal_UINT32(dataSize_in, &pctx, &sctx);         // 4S
-  marshal_array(data_in, dataSize_in, &pctx, &sctx); // 5S
-  sha1_finish(&sctx); // inParamDigest = sctx.hash
-
-  hmac_init(&hctx, nv_auth.authdata, sizeof(TPM_SECRET)); // compute pubAuth
-  marshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  marshal_UINT32(s->authHandle, &pctx, NULL);                      //
-  marshal_array(&s->nonceEven, sizeof(TPM_NONCE), NULL,            // 2H1
-                &hctx.sctx);                                       // 2H1
-  marshal_array(&s->nonceOdd, sizeof(TPM_NONCE), &pctx,            // 3H1
-                &hctx.sctx);                                       // 3H1
-  marshal_BYTE(s->continueAuthSession, &pctx, &hctx.sctx);         // 4H1
-  hmac_finish(&hctx); // inAuth = hctx.sctx.hash
-  marshal_array(&hctx.sctx.hash, sizeof(TPM_DIGEST), &pctx, NULL); //
-
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
+  return tpm_transmit(&tpm_cmd_nv_write_value_auth, in, NULL, &auth, 1);
+}
+
+RESULT_(DATA_VIEW)
+TPM_NV_ReadValue(TPM_NV_INDEX nvIndex_in, UINT32 offset_in, UINT32 dataSize_in,
+                 OPTION(TPM_AUTHDATA) ownerAuth_in, TPM_SESSION **session) {
+  ASSERT((ownerAuth_in.hasValue && session && *session) ||
+         (!ownerAuth_in.hasValue && (!session || !*session)));
+  RESULT_(DATA_VIEW) ret = {.exception.error = NONE,
+                            .value = {dataSize_in, NULL}};
+  const TPM_ARG in[] = {{nvIndex_in}, {offset_in}, {dataSize_in}};
+  void *const out[] = {&ret.value};
+  struct tpm_auth auth = {session, ownerAuth_in.value.authdata};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_nv_read_value, in, out, &auth,
+                                     ownerAuth_in.hasValue);
   THROW(transmit_ret.exception);
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
+  return ret;
+}
 
-  sha1_init(&sctx);                              // compute outParamDigest
-  unmarshal_UINT16(&tag_out, &uctx, NULL);       //
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL); //
-  unmarshal_UINT32(&res, &uctx, &sctx);          // 1S
-  TPM_ERROR(res);                                //
-  unmarshal_UINT32(&ordinal_in, NULL, &sctx);    // 2S
-  sha1_finish(&sctx);                            // outParamDigest = sctx.hash
-
-  hmac_init(&hctx, nv_auth.authdata, sizeof(TPM_SECRET)); // compute HM
-  unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  unmarshal_array(&s->nonceEven, sizeof(TPM_NONCE), &uctx,           // 2H1
-                  &hctx.sctx);                                       // 2H1
-  unmarshal_array(&s->nonceOdd, sizeof(TPM_NONCE), NULL,             // 3H1
-                  &hctx.sctx);                                       // 3H1
-  unmarshal_BYTE(&s->continueAuthSession, &uctx, &hctx.sctx);        // 4H1
-  unmarshal_array(&resAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);  //
-  hmac_finish(&hctx); // HM = hctx.sctx.hash
+/* The bytes around the data of a NV command or response: the header, the
+ * index, offset and size, and the authorization of a write */
+#define NV_WRITE_OVERHEAD                                                      \
+  (sizeof(TPM_TAG) + 6 * sizeof(UINT32) + sizeof(TPM_NONCE) + 1 +              \
+   sizeof(TPM_AUTHDATA))
+#define NV_READ_OVERHEAD (sizeof(TPM_TAG) + 3 * sizeof(UINT32))
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_AUTH1_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
+/* TPM_CAP_PROP_INPUT_BUFFER, it is only asked for once */
+static UINT32 tpm_buffer_size;
 
-  if (!s->continueAuthSession)
-    *session = NULL;
+/* The caches are in .bss, which the late launch neither measures nor clears */
+void tpm_cache_reset(void) {
+  memset(&pcr_shadow, 0, sizeof(pcr_shadow));
+  tpm_buffer_size = 0;
+}
 
-  ERROR(memcmp(&hctx.sctx.hash, &resAuth_out, sizeof(TPM_AUTHDATA)),
-        ERROR_TPM_BAD_OUTPUT_AUTH, "Bad nvAuth out");
+/**
+ * EXCEPT:
+ * ERROR_TIS_TRANSMIT
+ * ERROR_TPM
+ * ERROR_TPM_BAD_OUTPUT_PARAM
+ *
+ * The most data of size bytes that one NV command with overhead bytes around
+ * it can move. An object that fits into the TIS buffers goes as a whole, as
+ * it always did, without asking the TPM for the size of its buffers first.
+ */
+static RESULT_(UINT32) nv_chunk_size(UINT32 size, UINT32 overhead) {
+  RESULT_(UINT32) ret = {.exception.error = NONE,
+                         .value = TIS_BUFFER_SIZE - overhead};
+
+  if (size <= ret.value)
+    return ret;
+  if (!tpm_buffer_size) {
+    UINT32 buffer_size;
+    RESULT cap_ret = TPM_GetCapability(
+        TPM_CAP_PROPERTY, TPM_CAP_PROP_INPUT_BUFFER, &buffer_size, 1);
+    THROW(cap_ret.exception);
+    tpm_buffer_size = buffer_size;
+  }
+  ERROR(tpm_buffer_size <= overhead, ERROR_TPM_BAD_OUTPUT_PARAM,
+        "TPM buffer too small");
+  if (tpm_buffer_size < TIS_BUFFER_SIZE)
+    ret.value = tpm_buffer_size - overhead;
 
   return ret;
 }
 
-RESULT_(HEAP_DATA)
-TPM_NV_ReadValue(TPM_NV_INDEX nvIndex_in, UINT32 offset_in, UINT32 dataSize_in,
-                 OPTION(TPM_AUTHDATA) ownerAuth_in, TPM_SESSION **session) {
-  ASSERT((ownerAuth_in.hasValue && session && *session) ||
-         (!ownerAuth_in.hasValue && (!session || !*session)));
-  RESULT_(HEAP_DATA) ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  TPM_TAG tag_in;
-  UINT32 paramSize_in;
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_NV_ReadValue;
+RESULT tpm_nv_write(const BYTE *data, UINT32 size, TPM_NV_INDEX index,
+                    TPM_AUTHDATA nv_auth, TPM_SESSION **session,
+                    NONCE_SOURCE next_nonce) {
+  ASSERT(session && *session && next_nonce);
+  RESULT ret = {.exception.error = NONE};
+  HEAP_DATA chunk = {size, (BYTE *)data};
+  TPM_ARG in[] = {{index}, {0}, {.ptr = &chunk}};
+  struct tpm_auth auth = {session, nv_auth.authdata};
   Pack_Context pctx;
-  Unpack_Context uctx;
   SHA1_Context sctx;
-  HMAC_Context hctx;
-  TPM_SESSION *s = session && *session ? *session : NULL;
 
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-  TPM_AUTHDATA ownerAuth_out;
-
-  if (s) {
-    tag_in = TPM_TAG_RQU_AUTH1_COMMAND;
-    paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) + sizeof(TPM_COMMAND_CODE) +
-                   sizeof(TPM_NV_INDEX) + sizeof(UINT32) + sizeof(UINT32) +
-                   sizeof(TPM_AUTHHANDLE) + sizeof(TPM_NONCE) +
-                   sizeof(TSS_BOOL) + sizeof(TPM_AUTHDATA);
-  } else {
-    tag_in = TPM_TAG_RQU_COMMAND;
-    paramSize_in = sizeof(TPM_TAG) + sizeof(UINT32) + sizeof(TPM_COMMAND_CODE) +
-                   sizeof(TPM_NV_INDEX) + sizeof(UINT32) + sizeof(UINT32);
+  RESULT_(UINT32) chunk_size = nv_chunk_size(size, NV_WRITE_OVERHEAD);
+  THROW(chunk_size.exception);
+
+  // the session stays open up to the last chunk
+  for (UINT32 offset = 0;; offset += chunk.dataSize) {
+    in[1].value = offset;
+    chunk.data = (BYTE *)data + offset;
+    chunk.dataSize = size - offset;
+    if (chunk.dataSize > chunk_size.value)
+      chunk.dataSize = chunk_size.value;
+    // while the TPM writes the previous chunk
+    tpm_marshal(&tpm_cmd_nv_write_value_auth, in, 1, &pctx, &sctx);
+    if (offset) {
+      RESULT complete_ret =
+          tpm_complete(&tpm_cmd_nv_write_value_auth, NULL, &auth, 1);
+      THROW(complete_ret.exception);
+      ERROR(!*session, ERROR_TPM_BAD_OUTPUT_PARAM, "NV session closed");
+      // a response of one chunk must not verify for another one
+      RESULT_(TPM_NONCE) nonceOdd = next_nonce();
+      THROW(nonceOdd.exception);
+      (*session)->nonceOdd = nonceOdd.value;
+    }
+    (*session)->continueAuthSession =
+        offset + chunk.dataSize < size ? TRUE : FALSE;
+    RESULT submit_ret = tpm_authorize(&pctx, &sctx, &auth, 1);
+    THROW(submit_ret.exception);
+    if (offset + chunk.dataSize == size)
+      break;
   }
+  return tpm_complete(&tpm_cmd_nv_write_value_auth, NULL, &auth, 1);
+}
 
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
-  sha1_init(&sctx); // compute inParamDigest
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, &sctx);  // 1S
-  marshal_UINT32(nvIndex_in, &pctx, &sctx);  // 2S
-  marshal_UINT32(offset_in, &pctx, &sctx);   // 3S
-  marshal_UINT32(dataSize_in, &pctx, &sctx); // 4S
-  sha1_finish(&sctx);                        // inParamDigest = sctx.hash
-
-  if (s) {
-    hmac_init(&hctx, ownerAuth_in.value.authdata,
-              sizeof(TPM_SECRET)); // compute ownerAuth
-    marshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-    marshal_UINT32(s->authHandle, &pctx, NULL);
-    marshal_array(&s->nonceEven, sizeof(TPM_NONCE), NULL, &hctx.sctx); // 2H1
-    marshal_array(&s->nonceOdd, sizeof(TPM_NONCE), &pctx, &hctx.sctx); // 3H1
-    marshal_BYTE(s->continueAuthSession, &pctx, &hctx.sctx);           // 4H1
-    hmac_finish(&hctx); // inAuth = hctx.sctx.hash
-    marshal_array(&hctx.sctx.hash, sizeof(TPM_NONCE), &pctx, NULL);
+RESULT_(DATA_VIEW) tpm_nv_read(TPM_NV_INDEX index, UINT32 size) {
+  RESULT_(DATA_VIEW) ret = {.exception.error = NONE};
+  DATA_VIEW chunk;
+  TPM_ARG in[] = {{index}, {0}, {0}};
+  void *const out[] = {&chunk};
+
+  RESULT_(UINT32) chunk_size = nv_chunk_size(size, NV_READ_OVERHEAD);
+  THROW(chunk_size.exception);
+  if (size <= chunk_size.value) {
+    const OPTION(TPM_AUTHDATA) no_auth = {.hasValue = false};
+    return TPM_NV_ReadValue(index, 0, size, no_auth, NULL);
   }
 
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
-  THROW(transmit_ret.exception);
-
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
-  sha1_init(&sctx); // compute outParamDigest
-  unmarshal_UINT16(&tag_out, &uctx, NULL);
-
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);
-  unmarshal_UINT32(&res, &uctx, &sctx);                             // 1S
-  TPM_ERROR(res);                                                   //
-  unmarshal_UINT32(&ordinal_in, NULL, &sctx);                       // 2S
-  unmarshal_UINT32(&ret.value.dataSize, &uctx, &sctx);              // 3S
-  unmarshal_ptr(&ret.value.data, ret.value.dataSize, &uctx, &sctx); // 4S
-  sha1_finish(&sctx); // outParamDigest = sctx.hash
-
-  if (s) {
-    hmac_init(&hctx, ownerAuth_in.value.authdata,
-              sizeof(TPM_SECRET)); // compute HM
-    unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx);    // 1H1
-    unmarshal_array(&s->nonceEven, sizeof(TPM_NONCE), &uctx, &hctx.sctx); // 2H1
-    unmarshal_array(&s->nonceOdd, sizeof(TPM_NONCE), NULL, &hctx.sctx);   // 3H1
-    unmarshal_BYTE(&s->continueAuthSession, &uctx, &hctx.sctx);           // 4H1
-    hmac_finish(&hctx); // HM = hctx.sctx.hash
-    unmarshal_array(&ownerAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);
-
-    if (!s->continueAuthSession) {
-      *session = NULL;
+  BYTE *data = alloc(heap, size);
+  ERROR(!data, ERROR_BUFFER_OVERFLOW, "no heap for the NV data");
+  in[2].value = chunk_size.value;
+  RESULT submit_ret = tpm_submit(&tpm_cmd_nv_read_value, in, NULL, 0);
+  THROW(submit_ret.exception);
+  for (UINT32 offset = 0; offset < size; offset += chunk.dataSize) {
+    chunk.dataSize = in[2].value;
+    RESULT complete_ret = tpm_complete(&tpm_cmd_nv_read_value, out, NULL, 0);
+    THROW(complete_ret.exception);
+    ERROR(chunk.dataSize != in[2].value, ERROR_TPM_BAD_OUTPUT_PARAM,
+          "Short NV read");
+
+    // ask for the next chunk, and copy this one while the TPM reads it
+    in[1].value = offset + chunk.dataSize;
+    if (in[1].value < size) {
+      if (in[2].value > size - in[1].value)
+        in[2].value = size - in[1].value;
+      submit_ret = tpm_submit(&tpm_cmd_nv_read_value, in, NULL, 0);
+      THROW(submit_ret.exception);
     }
+    memcpy(data + offset, chunk.data, chunk.dataSize);
   }
+  ret.value = (DATA_VIEW){size, data};
 
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  if (s) {
-    ERROR(tag_out != TPM_TAG_RSP_AUTH1_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-          "Bad tag_out");
-  } else {
-    ERROR(tag_out != TPM_TAG_RSP_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-          "Bad tag_out");
-  }
-  if (s) {
-    ERROR(memcmp(&hctx.sctx.hash, &ownerAuth_out, sizeof(TPM_AUTHDATA)),
-          ERROR_TPM_BAD_OUTPUT_AUTH, "Bad output ownerAuth");
-  }
   return ret;
 }
 
 RESULT_(HEAP_DATA)
-TPM_Unseal(TPM_STORED_DATA12 inData_in /* in */, TPM_KEY_HANDLE parentHandle_in,
+TPM_Unseal(DATA_VIEW inData_in /* in */, TPM_KEY_HANDLE parentHandle_in,
            TPM_AUTHDATA parentAuth, TPM_SESSION **parentSession,
            TPM_AUTHDATA dataAuth, TPM_SESSION **dataSession) {
   ASSERT(parentSession && dataSession);
-  RESULT_(HEAP_DATA) ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
-  SHA1_Context sctx;
-  HMAC_Context hctx;
-  TPM_SESSION *parentS = *parentSession;
-  TPM_SESSION *dataS = *dataSession;
-
-  TPM_TAG tag_in = TPM_TAG_RQU_AUTH2_COMMAND;
-  UINT32 inDataSize_in = sizeof_TPM_STORED_DATA12(&inData_in);
-  UINT32 paramSize_in =
-      sizeof(TPM_TAG) + sizeof(UINT32) + sizeof(TPM_COMMAND_CODE) +
-      sizeof(TPM_KEY_HANDLE) + inDataSize_in + sizeof(TPM_AUTHHANDLE) +
-      sizeof(TPM_NONCE) + sizeof(TSS_BOOL) + sizeof(TPM_AUTHDATA) +
-      sizeof(TPM_AUTHHANDLE) + sizeof(TPM_NONCE) + sizeof(TSS_BOOL) +
-      sizeof(TPM_AUTHDATA);
-
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_Unseal;
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-  TPM_AUTHDATA resAuth_out;
-  TPM_AUTHDATA dataAuth_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
-
-  sha1_init(&sctx); // compute inParamDigest
-  marshal_UINT16(tag_in, &pctx, NULL);
-  marshal_UINT32(paramSize_in, &pctx, NULL);
-  marshal_UINT32(ordinal_in, &pctx, &sctx); // 1S
-  marshal_UINT32(parentHandle_in, &pctx, NULL);
-  marshal_TPM_STORED_DATA12(&inData_in, &pctx, &sctx); // 2S
-  sha1_finish(&sctx); // inParamDigest = sctx.hash
-
-  hmac_init(&hctx, parentAuth.authdata,
-            sizeof(TPM_SECRET)); // compute parentAuth
-  marshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  marshal_UINT32(parentS->authHandle, &pctx, NULL);                //
-  marshal_array(&parentS->nonceEven, sizeof(TPM_NONCE), NULL,      // 2H1
-                &hctx.sctx);                                       // 2H1
-  marshal_array(&parentS->nonceOdd, sizeof(TPM_NONCE), &pctx,      // 3H1
-                &hctx.sctx);                                       // 3H1
-  marshal_BYTE(parentS->continueAuthSession, &pctx, &hctx.sctx);   // 4H1
-  hmac_finish(&hctx); // inAuth = hctx.sctx.hash
-  marshal_array(&hctx.sctx.hash, sizeof(TPM_DIGEST), &pctx, NULL);
-
-  hmac_init(&hctx, dataAuth.authdata, sizeof(TPM_SECRET)); // compute dataAuth
-  marshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H2
-  marshal_UINT32(dataS->authHandle, &pctx, NULL);                  //
-  marshal_array(&dataS->nonceEven, sizeof(TPM_NONCE), NULL,        // 2H2
-                &hctx.sctx);                                       // 2H2
-  marshal_array(&dataS->nonceOdd, sizeof(TPM_NONCE), &pctx,        // 3H2
-                &hctx.sctx);                                       // 3H2
-  marshal_BYTE(dataS->continueAuthSession, &pctx, &hctx.sctx);     // 4H2
-  hmac_finish(&hctx); // inAuth = hctx.sctx.hash
-  marshal_array(&hctx.sctx.hash, sizeof(TPM_DIGEST), &pctx, NULL);
-
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
+  RESULT_(HEAP_DATA) ret = {.exception.error = NONE,
+                            .value = {TIS_BUFFER_SIZE, NULL}};
+  const TPM_ARG in[] = {{parentHandle_in}, {.ptr = &inData_in}};
+  void *const out[] = {&ret.value};
+  struct tpm_auth auth[] = {{parentSession, parentAuth.authdata},
+                            {dataSession, dataAuth.authdata}};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_unseal, in, out, auth, 2);
   THROW(transmit_ret.exception);
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
-
-  sha1_init(&sctx);                                    // compute outParamDigest
-  unmarshal_UINT16(&tag_out, &uctx, NULL);             //
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL);       //
-  unmarshal_UINT32(&res, &uctx, &sctx);                // 1S
-  TPM_ERROR(res);                                      //
-  unmarshal_UINT32(&ordinal_in, NULL, &sctx);          // 2S
-  unmarshal_UINT32(&ret.value.dataSize, &uctx, &sctx); // 3S
-  unmarshal_ptr(&ret.value.data, ret.value.dataSize, &uctx, &sctx); // 4S
-  sha1_finish(&sctx); // outParamDigest = sctx.hash
-
-  hmac_init(&hctx, parentAuth.authdata, sizeof(TPM_SECRET)); // compute HM1
-  unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  unmarshal_array(&parentS->nonceEven, sizeof(TPM_NONCE), &uctx,     // 2H1
-                  &hctx.sctx);                                       // 2H1
-  unmarshal_array(&parentS->nonceOdd, sizeof(TPM_NONCE), NULL,       // 3H1
-                  &hctx.sctx);                                       // 3H1
-  unmarshal_BYTE(&parentS->continueAuthSession, &uctx, &hctx.sctx);  // 4H1
-  unmarshal_array(&resAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);  //
-  hmac_finish(&hctx); // HM = hctx.sctx.hash
-
-  if (!parentS->continueAuthSession) {
-    *parentSession = NULL;
-  }
-
-  ERROR(memcmp(&hctx.sctx.hash, &resAuth_out, sizeof(TPM_AUTHDATA)),
-        ERROR_TPM_BAD_OUTPUT_AUTH, "Bad output parentAuth");
-
-  hmac_init(&hctx, dataAuth.authdata, sizeof(TPM_SECRET)); // compute HM2
-  unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx);      // 1H2
-  unmarshal_array(&dataS->nonceEven, sizeof(TPM_NONCE), &uctx,            // 2H2
-                  &hctx.sctx);                                            // 2H2
-  unmarshal_array(&dataS->nonceOdd, sizeof(TPM_NONCE), NULL, &hctx.sctx); // 3H2
-  unmarshal_BYTE(&dataS->continueAuthSession, &uctx, &hctx.sctx);         // 4H2
-  unmarshal_array(&dataAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);      //
-  hmac_finish(&hctx); // HM = hctx.sctx.hash
-
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_AUTH2_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
-
-  ERROR(memcmp(&hctx.sctx.hash, &dataAuth_out, sizeof(TPM_AUTHDATA)),
-        ERROR_TPM_BAD_OUTPUT_AUTH, "Bad output dataAuth");
-
-  if (!dataS->continueAuthSession) {
-    *dataSession = NULL;
-  }
-
   return ret;
 }
 
@@ -624,95 +735,23 @@ TPM_Seal
      TPM_SESSION **session, TPM_SECRET sharedSecret) {
   ASSERT(session);
   RESULT_(TPM_STORED_DATA12) ret = {.exception.error = NONE};
-  TPM_RESULT res;
-  Pack_Context pctx;
-  Unpack_Context uctx;
-  SHA1_Context sctx;
-  HMAC_Context hctx;
-  TPM_SESSION *s = *session;
-
-  TPM_TAG tag_in = TPM_TAG_RQU_AUTH1_COMMAND;
-  UINT32 pcrInfoSize_in = sizeof_TPM_PCR_INFO_LONG(&pcrInfo_in);
-  UINT32 paramSize_in =
-      sizeof(TPM_TAG) + sizeof(UINT32) + sizeof(TPM_COMMAND_CODE) +
-      sizeof(TPM_KEY_HANDLE) + sizeof(TPM_ENCAUTH) + sizeof(UINT32) +
-      pcrInfoSize_in + sizeof(UINT32) + inDataSize_in + sizeof(TPM_AUTHHANDLE) +
-      sizeof(TPM_NONCE) + sizeof(TSS_BOOL) + sizeof(TPM_AUTHDATA);
-#ifdef USE_TPM_SEALX
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_Sealx;
-#else
-  TPM_COMMAND_CODE ordinal_in = TPM_ORD_Seal;
-#endif
-  TPM_TAG tag_out;
-  UINT32 paramSize_out;
-  TPM_AUTHDATA resAuth_out;
-
-  pack_init(&pctx, tis_buffers.in, sizeof(tis_buffers.in));
-
-  sha1_init(&sctx);                          // compute inParamDigest
-  marshal_UINT16(tag_in, &pctx, NULL);       //
-  marshal_UINT32(paramSize_in, &pctx, NULL); //
-  marshal_UINT32(ordinal_in, &pctx, &sctx);  // 1S
-  marshal_UINT32(keyHandle_in, &pctx, NULL); //
-  marshal_array(&encAuth_in, sizeof(TPM_ENCAUTH), &pctx, &sctx); // 2S
-  marshal_UINT32(pcrInfoSize_in, &pctx, &sctx);                  // 3S
-  marshal_TPM_PCR_INFO_LONG(&pcrInfo_in, &pctx, &sctx);          // 4S
-  marshal_UINT32(inDataSize_in, &pctx, &sctx);                   // 5S
-  marshal_array(inData_in, inDataSize_in, &pctx, &sctx);         // 6S
-  sha1_finish(&sctx); // inParamDigest = sctx.hash
-
-  hmac_init(&hctx, sharedSecret.authdata,
-            sizeof(TPM_SECRET)); // compute pubAuth
-  marshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  marshal_UINT32(s->authHandle, &pctx, NULL);                      //
-  marshal_array(&s->nonceEven, sizeof(TPM_NONCE), NULL,            // 2H1
-                &hctx.sctx);                                       // 2H1
-  marshal_array(&s->nonceOdd, sizeof(TPM_NONCE), &pctx,            // 3H1
-                &hctx.sctx);                                       // 3H1
-  marshal_BYTE(s->continueAuthSession, &pctx, &hctx.sctx);         // 4H1
-  hmac_finish(&hctx); // inAuth = hctx.sctx.hash
-  marshal_array(&hctx.sctx.hash, sizeof(TPM_DIGEST), &pctx, NULL); //
-
-  UINT32 bytes_packed = pack_finish(&pctx);
-  ASSERT(bytes_packed == paramSize_in);
-
-  RESULT transmit_ret = tis_transmit();
+  const HEAP_DATA data = {inDataSize_in, (BYTE *)inData_in};
+  const TPM_ARG in[] = {{keyHandle_in},
+                        {.ptr = &encAuth_in},
+                        {.ptr = &pcrInfo_in},
+                        {.ptr = &data}};
+  void *const out[] = {&ret.value};
+  struct tpm_auth auth = {session, sharedSecret.authdata};
+
+  RESULT transmit_ret = tpm_transmit(&tpm_cmd_seal, in, out, &auth, 1);
   THROW(transmit_ret.exception);
 
-  unpack_init(&uctx, tis_buffers.out, sizeof(tis_buffers.out));
-
-  sha1_init(&sctx);                              // compute outParamDigest
-  unmarshal_UINT16(&tag_out, &uctx, NULL);       //
-  unmarshal_UINT32(&paramSize_out, &uctx, NULL); //
-  unmarshal_UINT32(&res, &uctx, &sctx);          // 1S
-  TPM_ERROR(res);                                //
-  unmarshal_UINT32(&ordinal_in, NULL, &sctx);    // 2S
-  unmarshal_TPM_STORED_DATA12(&ret.value, &uctx, &sctx); // 3S
-  sha1_finish(&sctx); // outParamDigest = sctx.hash
-
-  hmac_init(&hctx, sharedSecret.authdata, sizeof(TPM_SECRET)); // compute HM
-  unmarshal_array(&sctx.hash, sizeof(TPM_DIGEST), NULL, &hctx.sctx); // 1H1
-  unmarshal_array(&s->nonceEven, sizeof(TPM_NONCE), &uctx,           // 2H1
-                  &hctx.sctx);                                       // 2H1
-  unmarshal_array(&s->nonceOdd, sizeof(TPM_NONCE), NULL,             // 3H1
-                  &hctx.sctx);                                       // 3H1
-  unmarshal_BYTE(&s->continueAuthSession, &uctx, &hctx.sctx);        // 4H1
-  unmarshal_array(&resAuth_out, sizeof(TPM_AUTHDATA), &uctx, NULL);  //
-  hmac_finish(&hctx); // HM = hctx.sctx.hash
-
-  UINT32 bytes_unpacked = unpack_finish(&uctx);
-  ERROR(bytes_unpacked != paramSize_out, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad paramSize_out");
-  ERROR(tag_out != TPM_TAG_RSP_AUTH1_COMMAND, ERROR_TPM_BAD_OUTPUT_PARAM,
-        "Bad tag_out");
-
-  ERROR(memcmp(&hctx.sctx.hash, &resAuth_out, sizeof(TPM_AUTHDATA)),
-        ERROR_TPM_BAD_OUTPUT_AUTH, "Bad output sealing key auth");
-  ERROR(s->continueAuthSession, ERROR_TPM_BAD_OUTPUT_PARAM,
+  // the ADIP session must end with the command
+  bool open = *session != NULL;
+  tpm_session_drop(session);
+  ERROR(open, ERROR_TPM_BAD_OUTPUT_PARAM,
         "TPM_Seal did not end the ADIP session");
 
-  *session = NULL;
-
   return ret;
 }
 #endif
@@ -198,6 +198,18 @@ void unmarshal_ptr(void *ptr, UINT32 size, Unpack_Context *ctx,
   }
 }
 
+void unmarshal_view(const BYTE **ptr, UINT32 size, Unpack_Context *ctx,
+                    SHA1_Context *sctx) {
+  ASSERT(ptr);
+  ASSERT(ctx);
+  check_unpack_overflow(ctx, size);
+  *ptr = ctx->unpack_buffer + ctx->bytes_unpacked;
+  ctx->bytes_unpacked += size;
+  if (sctx) {
+    sha1(sctx, *ptr, size);
+  }
+}
+
 void marshal_TPM_PCR_SELECTION(const TPM_PCR_SELECTION *select,
                                Pack_Context *ctx, SHA1_Context *sctx) {
   marshal_UINT16(select->sizeOfSelect, ctx, sctx);
@@ -281,6 +293,24 @@ UINT32 sizeof_TPM_STORED_DATA12(const TPM_STORED_DATA12 *storedData) {
   return ret;
 }
 
+UINT32 check_TPM_STORED_DATA12(const BYTE *data, UINT32 dataSize) {
+  UINT32 size = sizeof(TPM_STRUCTURE_TAG) + sizeof(TPM_ENTITY_TYPE);
+
+  if (dataSize < size || ntohs(*(const UINT16 *)data) != TPM_TAG_STORED_DATA12)
+    return 0;
+  // sealInfo and encData, each after its size
+  for (int i = 0; i < 2; i++) {
+    if (dataSize - size < sizeof(UINT32))
+      return 0;
+    UINT32 n = ntohl(*(const UINT32 *)(data + size));
+    size += sizeof(UINT32);
+    if (n > dataSize - size)
+      return 0;
+    size += n;
+  }
+  return size;
+}
+
 // ret = xor(entityAuthData, sha1(sharedSecret ++ authLastNonceEven))
 TPM_ENCAUTH encAuth_gen(TPM_AUTHDATA entityAuthData, TPM_SECRET sharedSecret,
                         TPM_NONCE authLastNonceEven) {
@@ -331,16 +361,6 @@ UINT32 pack_TPM_STORED_DATA12(BYTE *data /* out */, UINT32 dataSize,
   return pack_finish(&pctx);
 }
 
-TPM_STORED_DATA12 unpack_TPM_STORED_DATA12(const BYTE *data /* in */,
-                                           UINT32 dataSize) {
-  TPM_STORED_DATA12 ret;
-  Unpack_Context uctx;
-  unpack_init(&uctx, data, dataSize);
-  unmarshal_TPM_STORED_DATA12(&ret, &uctx, NULL);
-  unpack_finish(&uctx);
-  return ret;
-}
-
 struct extracted_TPM_STORED_DATA12
 extract_TPM_STORED_DATA12(TPM_STORED_DATA12 storedData) {
   UINT32 size = sizeof_TPM_STORED_DATA12(&storedData);
@@ -348,10 +348,14 @@ void out_info(const char *msg) {
  * Function to output a hash.
  */
 void show_hash(const char *s, TPM_DIGEST hash) {
+  show_hash_bytes(s, hash.digest, TPM_SHA1_160_HASH_LEN);
+}
+
+void show_hash_bytes(const char *s, const BYTE *hash, UINT32 len) {
   out_string(message_label);
   out_string(s);
-  for (UINT32 i = 0; i < 20; i++)
-    out_hex(hash.digest[i], 7);
+  for (UINT32 i = 0; i < len; i++)
+    out_hex(hash[i], 7);
   out_char('\n');
 }
 
@@ -0,0 +1,89 @@
+#ifndef __ASM_H__
+#define __ASM_H__
+
+/*
+ * \brief   Host replacement of asm.h for sable-bench.
+ *
+ * The control register accessors do nothing, as the host kernel has already
+ * enabled SSE and AVX. The CPUID feature bits can be masked at run time, so
+ * that sha1_simd_begin() selects each of the block functions in turn.
+ */
+
+void reboot(void) __attribute__((noreturn));
+void do_skinit(void) __attribute__((noreturn));
+void jmp_multiboot(void *mbi, unsigned int entry) __attribute__((noreturn));
+
+extern unsigned int bench_mask_ecx1;
+extern unsigned int bench_mask_edx1;
+extern unsigned int bench_mask_ebx7;
+
+static inline unsigned int ntohl(unsigned int v) {
+  return __builtin_bswap32(v);
+}
+
+static inline unsigned int htonl(unsigned int v) {
+  return __builtin_bswap32(v);
+}
+
+static inline unsigned long long rdtsc(void) {
+  unsigned long long res;
+  asm volatile("rdtsc" : "=A"(res));
+  return res;
+}
+
+static inline void cpuid(unsigned leaf, unsigned subleaf, unsigned *regs) {
+  asm volatile("cpuid"
+               : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+               : "a"(leaf), "c"(subleaf));
+}
+
+static inline unsigned int cpuid_eax(unsigned value) {
+  unsigned regs[4];
+  cpuid(value, 0, regs);
+  return regs[0];
+}
+
+static inline unsigned int cpuid_ecx(unsigned value) {
+  unsigned regs[4];
+  cpuid(value, 0, regs);
+  return value == 1 ? regs[2] & ~bench_mask_ecx1 : regs[2];
+}
+
+static inline unsigned int cpuid_edx(unsigned value) {
+  unsigned regs[4];
+  cpuid(value, 0, regs);
+  return value == 1 ? regs[3] & ~bench_mask_edx1 : regs[3];
+}
+
+static inline unsigned int cpuid_ebx1(unsigned value, unsigned subleaf) {
+  unsigned regs[4];
+  cpuid(value, subleaf, regs);
+  return value == 7 ? regs[1] & ~bench_mask_ebx7 : regs[1];
+}
+
+#define CR0_MP 0x00000002
+#define CR0_EM 0x00000004
+#define CR0_TS 0x00000008
+
+#define CR4_FXSR 0x00000200
+#define CR4_XMM 0x00000400
+#define CR4_OSXSAVE 0x00040000
+
+static inline unsigned long read_cr0(void) { return CR0_MP; }
+static inline void write_cr0(unsigned long value) { (void)value; }
+static inline unsigned long read_cr4(void) {
+  return CR4_FXSR | CR4_XMM | CR4_OSXSAVE;
+}
+static inline void write_cr4(unsigned long value) { (void)value; }
+
+static inline unsigned long long xgetbv(unsigned int index) {
+  unsigned int lo, hi;
+  asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+  return ((unsigned long long)hi << 32) | lo;
+}
+static inline void xsetbv(unsigned int index, unsigned long long value) {
+  (void)index;
+  (void)value;
+}
+
+#endif
@@ -0,0 +1,686 @@
+/*
+ * \brief   Host microbenchmarks for SABLE's crypto, marshalling and allocator.
+ *
+ * Every SHA-1 and SHA-256 block function this CPU supports is checked
+ * against known answers and, for SHA-1, against the scalar code on random
+ * input before it is timed. The unrolled and the compact SHA-1 are checked
+ * against each other. The results are written to
+ * stdout as CSV, one line per measurement, diagnostics go to stderr. The
+ * exit status is non-zero if any known-answer test fails.
+ */
+
+#include "platform.h"
+#include "alloc.h"
+#include "heap.h"
+#include "hmac.h"
+#include "mgf1.h"
+#include "sha.h"
+#include "sha_alt.h"
+#include "sha256.h"
+#include "tpm_struct.h"
+#include "util.h"
+#include "asm.h"
+#include "shim.h"
+
+/* every measurement runs for at least this long */
+#define BENCH_MIN_NS 50000000
+/* and the clock is read after batches of at least this length */
+#define BENCH_BATCH_NS 1000000
+
+#define BUFFER_SIZE (1 << 20)
+/* the struct mem_node in front of every block of alloc.c */
+#define BLOCK_HEADER_SIZE 8
+
+static BYTE heap_array[1 << 20] __attribute__((aligned(8)));
+BYTE *heap = heap_array;
+static const UINT32 heap_size = sizeof(heap_array);
+
+enum bench_cpuid {
+  ECX1_SSSE3 = 1 << 9,
+  ECX1_SSE41 = 1 << 19,
+  ECX1_XSAVE = 1 << 26,
+  ECX1_AVX = 1 << 28,
+  EDX1_FXSR = 1 << 24,
+  EDX1_SSE2 = 1 << 26,
+  EBX7_BMI1 = 1 << 3,
+  EBX7_AVX2 = 1 << 5,
+  EBX7_BMI2 = 1 << 8,
+  EBX7_SHA = 1 << 29,
+};
+
+unsigned int bench_mask_ecx1;
+unsigned int bench_mask_edx1;
+unsigned int bench_mask_ebx7;
+
+/*
+ * A block function is selected by hiding the CPUID bits of all faster ones
+ * from sha1_simd_begin() and sha256_simd_begin().
+ */
+struct backend {
+  const char *name;
+  bool sha256;
+  unsigned int need_ecx1, need_edx1, need_ebx7;
+  unsigned int mask_ecx1, mask_edx1, mask_ebx7;
+};
+
+static const struct backend backends[] = {
+    {"scalar", true, 0, 0, 0, 0, EDX1_SSE2, EBX7_SHA},
+#ifdef SHA1_SIMD
+    {"vec-sse2", false, 0, EDX1_FXSR | EDX1_SSE2, 0, ECX1_SSSE3 | ECX1_AVX, 0,
+     EBX7_SHA},
+    {"vec-ssse3", false, ECX1_SSSE3, EDX1_FXSR | EDX1_SSE2, 0, ECX1_AVX, 0,
+     EBX7_SHA},
+    {"vec-avx2", false, ECX1_XSAVE | ECX1_AVX, EDX1_FXSR | EDX1_SSE2,
+     EBX7_AVX2 | EBX7_BMI1 | EBX7_BMI2, 0, 0, EBX7_SHA},
+    {"shani", true, ECX1_SSSE3 | ECX1_SSE41, EDX1_FXSR | EDX1_SSE2, EBX7_SHA,
+     0, 0, 0},
+#endif
+};
+
+static BYTE buffer[BUFFER_SIZE] __attribute__((aligned(64)));
+static BYTE scratch[4096] __attribute__((aligned(64)));
+static unsigned failures;
+
+/* known-answer tests */
+
+static const struct {
+  const char *msg;
+  UINT32 repeat;
+  const char *sha1;
+  const char *sha256;
+} kats[] = {
+    {"", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+     "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    // 2^32 + 8 bits, the length does not fit into the low word
+    {"abc", 178956971, "f687abd970100a7ad888e521e7b24fa5ab9fe946",
+     "e742448eb0ad36ee4be27b73a83d7b00ea641c082c4286a0ba4619b65aec4382"},
+};
+
+/* the padding does not depend on the backend, so the long message is only
+ * hashed with the fastest one, see run_backend() */
+#define SHORT_KATS (sizeof(kats) / sizeof(kats[0]) - 1)
+
+static BYTE hex_nibble(char c) {
+  return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+static void check(const char *what, const char *name, const BYTE *digest,
+                  const char *expected) {
+  UINT32 len = strlen(expected) / 2;
+
+  for (UINT32 i = 0; i < len; i++)
+    if (digest[i] != (hex_nibble(expected[2 * i]) << 4 |
+                      hex_nibble(expected[2 * i + 1]))) {
+      out_info("KAT failed:");
+      out_info(what);
+      out_info(name);
+      failures++;
+      return;
+    }
+}
+
+static void check_equal(const char *what, const char *name, const BYTE *a,
+                        const BYTE *b, UINT32 len) {
+  if (memcmp(a, b, len)) {
+    out_info("KAT failed:");
+    out_info(what);
+    out_info(name);
+    failures++;
+  }
+}
+
+/* the message of a KAT, fed in pieces of a repeated string */
+static const BYTE *kat_message(unsigned i, UINT32 *piece) {
+  UINT32 len = strlen(kats[i].msg);
+  UINT32 n = 0;
+
+  if (kats[i].repeat == 1) {
+    *piece = len;
+    return (const BYTE *)kats[i].msg;
+  }
+  while (n + len <= sizeof(scratch) && n / len < kats[i].repeat) {
+    memcpy(scratch + n, kats[i].msg, len);
+    n += len;
+  }
+  *piece = n;
+  return scratch;
+}
+
+static void kat_sha1(const char *name, unsigned count) {
+  SHA1_Context ctx;
+
+  for (unsigned i = 0; i < count; i++) {
+    UINT32 piece, left = strlen(kats[i].msg) * kats[i].repeat;
+    const BYTE *msg = kat_message(i, &piece);
+
+    sha1_init(&ctx);
+    for (; left > piece; left -= piece)
+      sha1_stream(&ctx, msg, piece);
+    sha1_stream(&ctx, msg, left);
+    sha1_finish(&ctx);
+    check("sha1", name, ctx.hash.digest, kats[i].sha1);
+  }
+}
+
+/* xorshift32, the cross-checks only need lengths and offsets that vary */
+static UINT32 next_random(UINT32 *x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+  return *x;
+}
+
+/*
+ * Hash data with sha1_stream(), passing the first split bytes in a call of
+ * their own, and with alt_sha1_stream() in one call, and compare the digests.
+ */
+static void check_sha1_alt(const char *what, const char *name,
+                           const BYTE *data, UINT32 len, UINT32 split) {
+  SHA1_Context ctx, alt;
+
+  sha1_init(&ctx);
+  sha1_stream(&ctx, data, split);
+  sha1_stream(&ctx, data + split, len - split);
+  sha1_finish(&ctx);
+  alt_sha1_init(&alt);
+  alt_sha1_stream(&alt, data, len);
+  alt_sha1_finish(&alt);
+  check_equal(what, name, ctx.hash.digest, alt.hash.digest,
+              sizeof(TPM_DIGEST));
+}
+
+/* the unrolled and the compact SHA-1 have to agree on the KAT messages and
+ * on random lengths at random offsets of buffer */
+static void kat_sha1_variants(void) {
+  UINT32 x = 1;
+
+  for (unsigned i = 0; i < SHORT_KATS; i++) {
+    UINT32 piece;
+    const BYTE *msg = kat_message(i, &piece);
+    check_sha1_alt("sha1 variants", "kat", msg, piece, piece);
+  }
+  for (unsigned i = 0; i < 256; i++) {
+    UINT32 len = next_random(&x) % 4096;
+    check_sha1_alt("sha1 variants", "random", buffer + next_random(&x) % 64,
+                   len, len);
+  }
+}
+
+/*
+ * The block function of a backend has to agree with the scalar SHA-1 of
+ * sha_alt.c for the lengths around the padding boundaries of the last block,
+ * after up to 8 whole blocks and at every offset within 16 bytes, and for
+ * random lengths, offsets and splits.
+ */
+static void kat_sha1_backend(const char *name) {
+  static const UINT32 tails[] = {0,  1,  55,  56,  57,  63,  64,
+                                 65, 119, 120, 121, 127, 128, 129};
+  static const UINT32 blocks[] = {0, 1, 3, 8};
+  UINT32 x = 2;
+
+  for (unsigned i = 0; i < sizeof(tails) / sizeof(tails[0]); i++)
+    for (unsigned j = 0; j < sizeof(blocks) / sizeof(blocks[0]); j++)
+      for (unsigned offset = 0; offset < 16; offset++) {
+        UINT32 len = tails[i] + 64 * blocks[j];
+        check_sha1_alt("sha1 vs scalar", name, buffer + offset, len, len);
+      }
+  for (unsigned i = 0; i < 512; i++) {
+    UINT32 len = next_random(&x) % 8192;
+    UINT32 offset = next_random(&x) % 64;
+    check_sha1_alt("sha1 vs scalar", name, buffer + offset, len,
+                   next_random(&x) % (len + 1));
+  }
+}
+
+/* sha1_multi() has to give the same digests as hashing one after another */
+static void kat_sha1_multi(const char *name) {
+  static const UINT32 sizes[] = {1000, 17000, 64, 5003, 0, 130};
+  SHA1_Context multi[6], single;
+  SHA1_Job jobs[6];
+
+  for (unsigned i = 0; i < 6; i++) {
+    sha1_init(multi + i);
+    jobs[i] = (SHA1_Job){
+        .data = buffer + 4096 * i + i, .count = sizes[i], .ctx = multi + i};
+  }
+  sha1_multi(jobs, 6);
+  for (unsigned i = 0; i < 6; i++) {
+    sha1_finish(multi + i);
+    sha1_init(&single);
+    sha1_stream(&single, buffer + 4096 * i + i, sizes[i]);
+    sha1_finish(&single);
+    check_equal("sha1_multi", name, multi[i].hash.digest, single.hash.digest,
+                sizeof(TPM_DIGEST));
+  }
+}
+
+static void kat_sha256(const char *name, unsigned count) {
+  SHA256_Context ctx;
+
+  for (unsigned i = 0; i < count; i++) {
+    UINT32 piece, left = strlen(kats[i].msg) * kats[i].repeat;
+    const BYTE *msg = kat_message(i, &piece);
+
+    sha256_init(&ctx);
+    for (; left > piece; left -= piece)
+      sha256_stream(&ctx, msg, piece);
+    sha256_stream(&ctx, msg, left);
+    sha256_finish(&ctx);
+    check("sha256", name, ctx.hash.digest, kats[i].sha256);
+  }
+}
+
+/* RFC 2202 test cases 1 and 7 */
+static void kat_hmac(void) {
+  HMAC_Context ctx;
+  BYTE key[80];
+
+  memset(key, 0x0b, 20);
+  hmac_init(&ctx, key, 20);
+  hmac(&ctx, "Hi There", 8);
+  hmac_finish(&ctx);
+  check("hmac", "short key", ctx.sctx.hash.digest,
+        "b617318655057264e28bc0b6fb378c8ef146be00");
+
+  memset(key, 0xaa, 80);
+  hmac_init(&ctx, key, 80);
+  hmac(&ctx, "Test Using Larger Than Block-Size Key - Hash Key First", 54);
+  hmac_finish(&ctx);
+  check("hmac", "long key", ctx.sctx.hash.digest,
+        "aa4ae5e15272d00e95705637ce8a3b55ed402112");
+
+  // a precomputed key has to be usable more than once
+  HMAC_Key hkey;
+  memset(key, 0x0b, 20);
+  hmac_key(&hkey, key, 20);
+  for (unsigned i = 0; i < 2; i++) {
+    hmac_start(&ctx, &hkey);
+    hmac(&ctx, "Hi There", 8);
+    hmac_finish(&ctx);
+    check("hmac", "precomputed key", ctx.sctx.hash.digest,
+          "b617318655057264e28bc0b6fb378c8ef146be00");
+  }
+}
+
+static void kat_mgf1(void) {
+  BYTE seed[20];
+  BYTE mask[256];
+
+  for (unsigned i = 0; i < sizeof(seed); i++)
+    seed[i] = i;
+  mgf1(seed, sizeof(seed), mask, sizeof(mask));
+  check("mgf1", "first", mask, "028553d821db1e8d1bc66ba574c0e31031052931");
+  check("mgf1", "last", mask + 236, "867d779cbdc32a9f9d26038397d634132811177f");
+
+  // more than 256 counter blocks
+  SHA1_Context sctx;
+  mgf1(seed, sizeof(seed), scratch, 4001);
+  sha1_init(&sctx);
+  sha1_stream(&sctx, scratch, 4001);
+  sha1_finish(&sctx);
+  check("mgf1", "long", sctx.hash.digest,
+        "54f4d6f87832fd9d5afdee797e11083b8d14eefb");
+
+  // XORing the mask in place twice restores the data
+  memcpy(mask, buffer, sizeof(mask));
+  mgf1_xor(seed, sizeof(seed), mask, sizeof(mask));
+  mgf1_xor(seed, sizeof(seed), mask, sizeof(mask));
+  check_equal("mgf1", "xor", mask, buffer, sizeof(mask));
+}
+
+static const UINT32 alloc_sizes[] = {12, 20, 64, 256, 4, 1024, 32, 512};
+
+/* fill the blocks with a pattern that freeing them has to wipe */
+static void *alloc_filled(void *heap, UINT32 i) {
+  BYTE *block = alloc(heap, alloc_sizes[i & 7]);
+  if (block)
+    memset(block, 0xa5, alloc_sizes[i & 7]);
+  return block;
+}
+
+static void check_wiped(const char *name, BYTE **p, UINT32 count) {
+  for (UINT32 i = 0; i < count; i++)
+    for (UINT32 j = 0; j < alloc_sizes[i & 7]; j++)
+      if (p[i][j]) {
+        out_info("KAT failed:");
+        out_info(name);
+        failures++;
+        return;
+      }
+}
+
+/* freed blocks and released scopes have to be wiped and usable again, in one
+ * piece */
+static void kat_alloc(void) {
+  static BYTE small[8 * 1024] __attribute__((aligned(8)));
+  BYTE *p[24];
+
+  init_heap(small, sizeof(small));
+  for (unsigned i = 0; i < 24; i++)
+    p[i] = alloc_filled(small, i);
+  // every other block first, so that the rest merges with both neighbours
+  for (unsigned i = 0; i < 24; i += 2)
+    dealloc(small, p[i]);
+  for (unsigned i = 1; i < 24; i += 2)
+    dealloc(small, p[i]);
+  check_wiped("dealloc wipes", p, 24);
+  if (!alloc(small, sizeof(small) - BLOCK_HEADER_SIZE)) {
+    out_info("KAT failed:");
+    out_info("alloc after dealloc");
+    failures++;
+  }
+
+  init_heap(small, sizeof(small));
+  void *outer = alloc(small, 20);
+  UINT32 scope = heap_mark();
+  for (unsigned i = 0; i < 24; i++)
+    p[i] = alloc_filled(small, i);
+  dealloc(small, p[5]);
+  heap_release(small, scope);
+  check_wiped("heap_release wipes", p, 24);
+  void *inner = alloc(small, sizeof(small) - 2 * BLOCK_HEADER_SIZE - 24);
+  if (!inner || inner != p[0]) {
+    out_info("KAT failed:");
+    out_info("alloc after heap_release");
+    failures++;
+  }
+  UNUSED(outer);
+}
+
+/* timing */
+
+typedef void (*bench_fn)(UINT32 param);
+
+static void out_fixed1(UINT64 tenths) {
+  UINT64 q = div64(tenths, 10);
+
+  out_u64(q);
+  out_string(".");
+  out_u64(tenths - q * 10);
+}
+
+/*
+ * Call fn(param) for at least BENCH_MIN_NS and print one CSV line. Bytes is
+ * the amount of data processed per call, or 0 if no throughput applies.
+ */
+static void run(const char *suite, const char *name, UINT32 param,
+                UINT32 bytes, bench_fn fn) {
+  UINT64 start, elapsed, cycles, iterations = 0;
+  UINT32 batch = 1;
+
+  fn(param);
+  start = now_ns();
+  cycles = rdtsc();
+  do {
+    UINT64 batch_start = now_ns();
+    for (UINT32 i = 0; i < batch; i++)
+      fn(param);
+    iterations += batch;
+    if (now_ns() - batch_start < BENCH_BATCH_NS)
+      batch *= 2;
+    elapsed = now_ns() - start;
+  } while (elapsed < BENCH_MIN_NS);
+  cycles = rdtsc() - cycles;
+
+  // elapsed is well below 2^32 ns, iterations and bytes are not
+  out_string(suite);
+  out_string(",");
+  out_string(name);
+  out_string(",");
+  out_u64(param);
+  out_string(",");
+  out_u64(iterations);
+  out_string(",");
+  out_fixed1(div64(elapsed * 10, iterations));
+  out_string(",");
+  if (bytes)
+    out_fixed1(div64(iterations * bytes * 10000, elapsed));
+  out_string(",");
+  out_fixed1(div64(cycles * 10, iterations));
+  out_string("\n");
+}
+
+static void bench_sha1(UINT32 size) {
+  SHA1_Context ctx;
+  sha1_init(&ctx);
+  sha1_stream(&ctx, buffer, size);
+  sha1_finish(&ctx);
+}
+
+/* four jobs of the given size each, as mbi_calc_hash() submits them */
+static void bench_sha1_multi(UINT32 size) {
+  SHA1_Context ctx[4];
+  SHA1_Job jobs[4];
+
+  for (unsigned i = 0; i < 4; i++) {
+    sha1_init(ctx + i);
+    jobs[i] = (SHA1_Job){.data = buffer + i * size, .count = size,
+                         .ctx = ctx + i};
+  }
+  sha1_multi(jobs, 4);
+  for (unsigned i = 0; i < 4; i++)
+    sha1_finish(ctx + i);
+}
+
+static void bench_sha256(UINT32 size) {
+  SHA256_Context ctx;
+  sha256_init(&ctx);
+  sha256_stream(&ctx, buffer, size);
+  sha256_finish(&ctx);
+}
+
+/* an HMAC of a nonce-sized message, as for every TPM authorization */
+static void bench_hmac(UINT32 size) {
+  HMAC_Context ctx;
+  hmac_init(&ctx, buffer, sizeof(TPM_AUTHDATA));
+  hmac(&ctx, buffer + 64, size);
+  hmac_finish(&ctx);
+}
+
+static HMAC_Key bench_key;
+
+static void bench_hmac_key(UINT32 size) {
+  hmac_key(&bench_key, buffer, size);
+}
+
+/* an HMAC with a precomputed key, as for the response of a TPM command */
+static void bench_hmac_start(UINT32 size) {
+  HMAC_Context ctx;
+  hmac_start(&ctx, &bench_key);
+  hmac(&ctx, buffer + 64, size);
+  hmac_finish(&ctx);
+}
+
+/* mask data with a TPM_Sealx sized seed */
+static void bench_mgf1(UINT32 size) {
+  mgf1_xor(buffer, 2 * sizeof(TPM_NONCE) + 3 + sizeof(TPM_SECRET), scratch,
+           size);
+}
+
+static TPM_STORED_DATA12 stored_data;
+
+static void bench_marshal(UINT32 size) {
+  pack_TPM_STORED_DATA12(scratch, sizeof(scratch), &stored_data);
+}
+
+static void bench_unmarshal(UINT32 size) {
+  TPM_STORED_DATA12 out;
+  Unpack_Context uctx;
+  unpack_init(&uctx, scratch, size);
+  unmarshal_TPM_STORED_DATA12(&out, &uctx, NULL);
+  unpack_finish(&uctx);
+}
+
+/* what trusted_boot() does instead, before it sends the data on */
+static void bench_check(UINT32 size) {
+  UINT32 checked = check_TPM_STORED_DATA12(scratch, size);
+  UNUSED(checked);
+}
+
+/* param allocations on a fresh heap, all of the same size */
+static void bench_alloc_fixed(UINT32 count) {
+  init_heap(heap, heap_size);
+  for (UINT32 i = 0; i < count; i++)
+    alloc(heap, 64);
+}
+
+/* param allocations cycling through the sizes SABLE typically requests */
+static void bench_alloc_mixed(UINT32 count) {
+  static const UINT32 sizes[] = {12, 20, 64, 256, 4, 1024, 32, 512};
+  init_heap(heap, heap_size);
+  for (UINT32 i = 0; i < count; i++)
+    alloc(heap, sizes[i & 7]);
+}
+
+/* param allocations of the mixed sizes in a scope, freed one by one */
+static void bench_alloc_free(UINT32 count) {
+  static const UINT32 sizes[] = {12, 20, 64, 256, 4, 1024, 32, 512};
+  static void *p[256];
+  init_heap(heap, heap_size);
+  for (UINT32 i = 0; i < count; i++)
+    p[i] = alloc(heap, sizes[i & 7]);
+  for (UINT32 i = 0; i < count; i++)
+    dealloc(heap, p[i]);
+}
+
+/* the same allocations, freed at once by releasing their scope */
+static void bench_alloc_release(UINT32 count) {
+  static const UINT32 sizes[] = {12, 20, 64, 256, 4, 1024, 32, 512};
+  init_heap(heap, heap_size);
+  UINT32 scope = heap_mark();
+  for (UINT32 i = 0; i < count; i++)
+    alloc(heap, sizes[i & 7]);
+  heap_release(heap, scope);
+}
+
+static bool backend_supported(const struct backend *b) {
+  unsigned int ebx7 = cpuid_eax(0) >= 7 ? cpuid_ebx1(7, 0) : 0;
+
+  return (cpuid_ecx(1) & b->need_ecx1) == b->need_ecx1 &&
+         (cpuid_edx(1) & b->need_edx1) == b->need_edx1 &&
+         (ebx7 & b->need_ebx7) == b->need_ebx7;
+}
+
+/* Run the KATs and benchmarks of b, including the long message if b is the
+ * last supported backend, respectively the last one with SHA-256 */
+static void run_backend(const struct backend *b, bool long_sha1,
+                        bool long_sha256) {
+  static const UINT32 sizes[] = {64, 1024, 16384, BUFFER_SIZE};
+  const unsigned all = sizeof(kats) / sizeof(kats[0]);
+
+  bench_mask_ecx1 = b->mask_ecx1;
+  bench_mask_edx1 = b->mask_edx1;
+  bench_mask_ebx7 = b->mask_ebx7;
+#ifdef SHA1_SIMD
+  sha1_simd_begin();
+  sha256_simd_begin();
+#endif
+
+  kat_sha1(b->name, long_sha1 ? all : SHORT_KATS);
+  kat_sha1_backend(b->name);
+  kat_sha1_multi(b->name);
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    run("sha1", b->name, sizes[i], sizes[i], bench_sha1);
+  run("sha1_multi", b->name, 16384, 4 * 16384, bench_sha1_multi);
+  run("sha1_multi", b->name, BUFFER_SIZE / 4, BUFFER_SIZE, bench_sha1_multi);
+
+  if (b->sha256) {
+    kat_sha256(b->name, long_sha256 ? all : SHORT_KATS);
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      run("sha256", b->name, sizes[i], sizes[i], bench_sha256);
+  }
+
+#ifdef SHA1_SIMD
+  sha256_simd_end();
+  sha1_simd_end();
+#endif
+  bench_mask_ecx1 = bench_mask_edx1 = bench_mask_ebx7 = 0;
+}
+
+int main(void) {
+  BYTE *seal_info = buffer, *enc_data = buffer + 128;
+  UINT32 packed;
+
+  for (UINT32 i = 0; i < BUFFER_SIZE; i++)
+    buffer[i] = i * 167 + (i >> 8);
+  init_heap(heap, heap_size);
+
+  out_string("suite,case,param,iterations,ns_per_op,mb_per_s,cycles_per_op\n");
+
+  const struct backend *fastest = backends, *fastest_sha256 = backends;
+  for (unsigned i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    if (backend_supported(backends + i)) {
+      fastest = backends + i;
+      if (backends[i].sha256)
+        fastest_sha256 = backends + i;
+    }
+
+  for (unsigned i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    if (backend_supported(backends + i))
+      run_backend(backends + i, backends + i == fastest,
+                  backends + i == fastest_sha256);
+    else {
+      out_info("skipping unsupported backend:");
+      out_info(backends[i].name);
+    }
+
+  // SABLE does all of the following with the scalar SHA-1
+  kat_sha1_variants();
+  kat_hmac();
+  run("hmac", "init_finish", 0, 0, bench_hmac);
+  run("hmac", "nonces", 2 * sizeof(TPM_NONCE), 0, bench_hmac);
+  run("hmac", "key", sizeof(TPM_AUTHDATA), 0, bench_hmac_key);
+  run("hmac", "start_finish", 2 * sizeof(TPM_NONCE), 0, bench_hmac_start);
+
+  kat_mgf1();
+  run("mgf1", "mask", sizeof(TPM_AUTHDATA), 0, bench_mgf1);
+  run("mgf1", "mask", 256, 0, bench_mgf1);
+
+  // a sealed passphrase: TPM_PCR_INFO_LONG plus a 2048-bit encrypted blob
+  stored_data = (TPM_STORED_DATA12){.tag = TPM_TAG_STORED_DATA12,
+                                    .et = TPM_ET_KEYHANDLE,
+                                    .sealInfoSize = 67,
+                                    .sealInfo = seal_info,
+                                    .encDataSize = 256,
+                                    .encData = enc_data};
+  packed = pack_TPM_STORED_DATA12(scratch, sizeof(scratch), &stored_data);
+  TPM_STORED_DATA12 unpacked;
+  Unpack_Context uctx;
+  unpack_init(&uctx, scratch, packed);
+  unmarshal_TPM_STORED_DATA12(&unpacked, &uctx, NULL);
+  if (packed != sizeof_TPM_STORED_DATA12(&stored_data) ||
+      unpack_finish(&uctx) != packed ||
+      check_TPM_STORED_DATA12(scratch, sizeof(scratch)) != packed ||
+      check_TPM_STORED_DATA12(scratch, packed - 1) != 0 ||
+      unpacked.sealInfoSize != 67 || unpacked.encDataSize != 256 ||
+      memcmp(unpacked.sealInfo, seal_info, 67) ||
+      memcmp(unpacked.encData, enc_data, 256)) {
+    out_info("KAT failed:");
+    out_info("TPM_STORED_DATA12 round trip");
+    failures++;
+  }
+  run("tpm_struct", "marshal_TPM_STORED_DATA12", packed, packed,
+      bench_marshal);
+  run("tpm_struct", "unmarshal_TPM_STORED_DATA12", packed, packed,
+      bench_unmarshal);
+  run("tpm_struct", "check_TPM_STORED_DATA12", packed, packed, bench_check);
+
+  run("alloc", "fixed_64", 16, 0, bench_alloc_fixed);
+  run("alloc", "fixed_64", 256, 0, bench_alloc_fixed);
+  run("alloc", "mixed", 16, 0, bench_alloc_mixed);
+  run("alloc", "mixed", 256, 0, bench_alloc_mixed);
+  kat_alloc();
+  run("alloc", "free", 16, 0, bench_alloc_free);
+  run("alloc", "free", 256, 0, bench_alloc_free);
+  run("alloc", "release", 16, 0, bench_alloc_release);
+  run("alloc", "release", 256, 0, bench_alloc_release);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * \brief   The SHA-1 compression function that sable-bench is not
+ * configured with.
+ *
+ * src/sha.c is compiled a second time with SHA1_UNROLLED flipped and without
+ * SHA1_SIMD, and with its symbols prefixed by alt_, so that bench.c can check
+ * the unrolled and the compact variant against each other.
+ */
+
+#ifdef SHA1_UNROLLED
+#undef SHA1_UNROLLED
+#else
+#define SHA1_UNROLLED
+#endif
+#undef SHA1_SIMD
+
+#define sha1_init alt_sha1_init
+#define sha1_resume alt_sha1_resume
+#define sha1 alt_sha1
+#define sha1_stream alt_sha1_stream
+#define sha1_multi alt_sha1_multi
+#define sha1_finish alt_sha1_finish
+
+#include "../../src/sha.c"
@@ -0,0 +1,14 @@
+#ifndef __SHA_ALT_H__
+#define __SHA_ALT_H__
+
+/*
+ * \brief   header of sha_alt.c
+ */
+
+#include "sha.h"
+
+void alt_sha1_init(SHA1_Context *ctx);
+void alt_sha1_stream(SHA1_Context *ctx, const void *val, UINT32 count);
+void alt_sha1_finish(SHA1_Context *ctx);
+
+#endif
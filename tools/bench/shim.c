@@ -0,0 +1,176 @@
+/*
+ * \brief   Minimal libc for sable-bench.
+ *
+ * Replaces util.c and the platform I/O with Linux i386 system calls, so that
+ * the SABLE sources can be linked into a static 32-bit host binary without
+ * a 32-bit C library.
+ */
+
+#include "platform.h"
+#include "util.h"
+#include "shim.h"
+
+enum {
+  SYS_EXIT = 1,
+  SYS_FORK = 2,
+  SYS_WRITE = 4,
+  SYS_WAITPID = 7,
+  SYS_MMAP = 90,
+  SYS_CLOCK_GETTIME = 265,
+  CLOCK_MONOTONIC = 1,
+  PROT_READ_WRITE = 3,
+  MAP_SHARED_ANONYMOUS = 0x21,
+};
+
+bool shim_quiet;
+
+static int syscall3(int nr, unsigned a, unsigned b, unsigned c) {
+  int res;
+  asm volatile("int $0x80"
+               : "=a"(res)
+               : "a"(nr), "b"(a), "c"(b), "d"(c)
+               : "memory");
+  return res;
+}
+
+void exit(unsigned status) {
+  syscall3(SYS_EXIT, status, 0, 0);
+  __builtin_unreachable();
+}
+
+void fail(void) {
+  out_string("FAIL\n");
+  exit(2);
+}
+
+void wait(int ms) {
+  UINT64 until = now_ns() + (UINT64)ms * 1000000;
+  while (now_ns() < until)
+    ;
+}
+
+void write_fd(int fd, const char *s, UINT32 len) {
+  while (len) {
+    int n = syscall3(SYS_WRITE, fd, (unsigned)s, len);
+    if (n <= 0)
+      return;
+    s += n;
+    len -= n;
+  }
+}
+
+UINT64 now_ns(void) {
+  struct {
+    long sec;
+    long nsec;
+  } ts;
+  syscall3(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (unsigned)&ts, 0);
+  return (UINT64)ts.sec * 1000000000 + ts.nsec;
+}
+
+int shim_fork(void) { return syscall3(SYS_FORK, 0, 0, 0); }
+
+int shim_wait(int pid) {
+  int status = 0;
+
+  if (syscall3(SYS_WAITPID, pid, (unsigned)&status, 0) != pid)
+    return -1;
+  // the exit status, or -1 if the child was killed
+  return status & 0x7f ? -1 : (status >> 8) & 0xff;
+}
+
+void *shim_shared(UINT32 size) {
+  // the old mmap system call takes its six arguments in memory
+  unsigned args[6] = {0, size, PROT_READ_WRITE, MAP_SHARED_ANONYMOUS, -1, 0};
+  int res = syscall3(SYS_MMAP, (unsigned)args, 0, 0);
+
+  return res < 0 && res > -4096 ? NULL : (void *)res;
+}
+
+UINT64 div64(UINT64 n, UINT32 d) {
+  UINT32 hi = n >> 32, lo = n, rem;
+  UINT32 q_hi = hi / d;
+
+  hi %= d;
+  // hi < d, so the quotient fits into 32 bits
+  asm("divl %4" : "=a"(lo), "=d"(rem) : "a"(lo), "d"(hi), "rm"(d));
+  return (UINT64)q_hi << 32 | lo;
+}
+
+void out_string(const char *value) {
+  if (!shim_quiet)
+    write_fd(1, value, strlen(value));
+}
+
+void out_info(const char *msg) {
+  write_fd(2, msg, strlen(msg));
+  write_fd(2, "\n", 1);
+}
+
+void out_u64(UINT64 value) {
+  char buf[21];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    UINT64 q = div64(value, 10);
+    buf[--i] = '0' + (value - q * 10);
+    value = q;
+  } while (value);
+  out_string(buf + i);
+}
+
+void out_description(const char *prefix, unsigned int value) {
+  if (shim_quiet)
+    return;
+  out_string(prefix);
+  out_string(": ");
+  out_u64(value);
+  out_string("\n");
+}
+
+void do_xor(const BYTE *in1, const BYTE *in2, BYTE *out, UINT32 size) {
+  for (UINT32 i = 0; i < size; i++)
+    out[i] = in1[i] ^ in2[i];
+}
+
+void *memcpy(void *dest, const void *src, UINT32 len) {
+  BYTE *d = dest;
+  const BYTE *s = src;
+  while (len--)
+    *d++ = *s++;
+  return dest;
+}
+
+void memset(void *s, BYTE c, UINT32 len) {
+  BYTE *p = s;
+  while (len--)
+    *p++ = c;
+}
+
+UINT32 memcmp(const void *buf1, const void *buf2, UINT32 size) {
+  const BYTE *a = buf1, *b = buf2;
+  for (UINT32 i = 0; i < size; i++)
+    if (a[i] != b[i])
+      return a[i] - b[i];
+  return 0;
+}
+
+UINT32 strlen(const char *str) {
+  UINT32 i = 0;
+  while (str[i])
+    i++;
+  return i;
+}
+
+int main(int argc, char **argv);
+
+/* the kernel passes argc and argv on the stack */
+static void __attribute__((used, noreturn)) start(unsigned long *sp) {
+  exit(main(sp[0], (char **)(sp + 1)));
+}
+asm(".globl _start\n"
+    "_start:\n"
+    "  mov %esp, %eax\n"
+    "  and $-16, %esp\n"
+    "  call start\n");
@@ -0,0 +1,24 @@
+#ifndef __SHIM_H__
+#define __SHIM_H__
+
+/*
+ * \brief   header of shim.c
+ */
+
+#include "platform.h"
+
+/* out_string() and out_description() print nothing while this is set */
+extern bool shim_quiet;
+
+void write_fd(int fd, const char *s, UINT32 len);
+UINT64 now_ns(void);
+UINT64 div64(UINT64 n, UINT32 d);
+void out_u64(UINT64 value);
+/* Returns the pid of the child in the parent and zero in the child */
+int shim_fork(void);
+/* Returns the exit status of the child, or -1 if it was killed */
+int shim_wait(int pid);
+/* Returns zeroed memory that is shared with the children */
+void *shim_shared(UINT32 size);
+
+#endif
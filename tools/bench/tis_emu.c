@@ -0,0 +1,289 @@
+/*
+ * \brief   TIS interface of the TPM model for sable-tpm-bench.
+ *
+ * tis.c, compiled with TIS_HOST, hands every register access to
+ * tis_host_read() and tis_host_write(). They emulate the FIFO interface of
+ * the TIS specification at TIS_BASE in front of tpm_model_execute(): the
+ * access registers of the localities, the states of the status register with
+ * its burst count, and the execution time of the command, until which no
+ * response is available. The TPM is not ready for the next command before
+ * then either, even after the locality changed.
+ */
+
+#include "platform.h"
+#include "tis.h"
+#include "util.h"
+#include "shim.h"
+#include "tpm_model.h"
+#include "tis_emu.h"
+
+#define EMU_LOCALITIES 5
+#define EMU_BUFFER_SIZE 4096
+#define EMU_BURST_COUNT 32
+
+/* the registers of a locality, see struct TIS_MMAP */
+enum tis_emu_register {
+  REG_ACCESS = 0x00,
+  REG_INT_ENABLE = 0x08,
+  REG_INT_VECTOR = 0x0c,
+  REG_INT_STATUS = 0x10,
+  REG_INTF_CAPABILITY = 0x14,
+  REG_STS = 0x18,
+  REG_BURST_COUNT = 0x19,
+  REG_DATA_FIFO = 0x24,
+  REG_DID_VID = TPM_DID_VID_0,
+  REG_RID = TPM_DID_VID_0 + 4,
+};
+
+enum tis_emu_state {
+  EMU_IDLE,
+  EMU_READY,
+  EMU_RECEPTION,
+  EMU_EXECUTION,
+  EMU_COMPLETION,
+};
+
+UINT32 tis_emu_access_ns;
+UINT32 tis_emu_accesses;
+
+static struct {
+  int active; // the active locality, or -1
+  BYTE requests;
+  BYTE seized;
+  unsigned int fifo_width;
+  UINT32 int_enable[EMU_LOCALITIES];
+  BYTE int_vector[EMU_LOCALITIES];
+  enum tis_emu_state state;
+  UINT64 done_ns;
+  UINT32 received;
+  UINT32 response_size;
+  UINT32 response_pos;
+  BYTE command[EMU_BUFFER_SIZE];
+  BYTE response[EMU_BUFFER_SIZE];
+} tis;
+
+void tis_emu_reset(unsigned int fifo_width) {
+  memset(&tis, 0, sizeof(tis));
+  tis.active = -1;
+  tis.fifo_width = fifo_width;
+  tis_emu_accesses = 0;
+}
+
+/* the TPM expects more bytes, until it has the paramSize of the header */
+static bool expect(void) {
+  if (tis.received < 10)
+    return true;
+  UINT32 size = tis.command[2] << 24 | tis.command[3] << 16 |
+                tis.command[4] << 8 | tis.command[5];
+  return tis.received < size;
+}
+
+static unsigned int burst_count(void) {
+  UINT32 left;
+
+  switch (tis.state) {
+  case EMU_READY:
+  case EMU_RECEPTION:
+    left = sizeof(tis.command) - tis.received;
+    break;
+  case EMU_COMPLETION:
+    left = tis.response_size - tis.response_pos;
+    break;
+  default:
+    left = 0;
+  }
+  return left < EMU_BURST_COUNT ? left : EMU_BURST_COUNT;
+}
+
+static BYTE sts(void) {
+  switch (tis.state) {
+  case EMU_READY:
+    return TIS_STS_VALID | (now_ns() >= tis.done_ns ? TIS_STS_CMD_READY : 0);
+  case EMU_RECEPTION:
+    return TIS_STS_VALID | (expect() ? TIS_STS_EXPECT : 0);
+  case EMU_EXECUTION:
+    return TIS_STS_VALID;
+  case EMU_COMPLETION:
+    return TIS_STS_VALID |
+           (tis.response_pos < tis.response_size ? TIS_STS_DATA_AVAIL : 0);
+  default:
+    return 0;
+  }
+}
+
+static void execute(unsigned int locality) {
+  UINT32 latency_us;
+
+  tis.response_size =
+      tpm_model_execute(locality, tis.command, tis.received, tis.response,
+                        sizeof(tis.response), &latency_us);
+  tis.response_pos = 0;
+  tis.state = latency_us ? EMU_EXECUTION : EMU_COMPLETION;
+  if (latency_us)
+    tis.done_ns = now_ns() + (UINT64)latency_us * 1000;
+}
+
+static void sts_write(unsigned int locality, BYTE value) {
+  if (value & TIS_STS_CMD_READY) {
+    // from any state, aborting a command in flight
+    tis.state = EMU_READY;
+    tis.received = 0;
+  }
+  if (value & TIS_STS_TPM_GO && tis.state == EMU_RECEPTION && !expect())
+    execute(locality);
+  if (value & TIS_STS_RETRY && tis.state == EMU_COMPLETION)
+    tis.response_pos = 0;
+}
+
+static void access_write(unsigned int locality, BYTE value) {
+  int old = tis.active;
+
+  if (value & TIS_ACCESS_SEIZED)
+    tis.seized &= ~(1 << locality);
+  if (value & TIS_ACCESS_ACTIVE) {
+    tis.requests &= ~(1 << locality);
+    if (tis.active == (int)locality) {
+      // hand over to the highest locality that waits
+      tis.active = -1;
+      for (int l = EMU_LOCALITIES - 1; l >= 0 && tis.active < 0; l--)
+        if (tis.requests & 1 << l) {
+          tis.requests &= ~(1 << l);
+          tis.active = l;
+        }
+    }
+  }
+  if (value & TIS_ACCESS_REQUEST && tis.active != (int)locality) {
+    if (tis.active < 0)
+      tis.active = locality;
+    else
+      tis.requests |= 1 << locality;
+  }
+  if (value & TIS_ACCESS_TO_SEIZE && tis.active >= 0 &&
+      (int)locality > tis.active) {
+    tis.seized |= 1 << tis.active;
+    tis.active = locality;
+  }
+  if (tis.active != old)
+    tis.state = EMU_IDLE;
+}
+
+static BYTE access_read(unsigned int locality) {
+  BYTE value = TIS_ACCESS_VALID;
+
+  if (tis.active == (int)locality)
+    value |= TIS_ACCESS_ACTIVE;
+  if (tis.requests & 1 << locality)
+    value |= TIS_ACCESS_REQUEST;
+  if (tis.requests & ~(1 << locality))
+    value |= TIS_ACCESS_PENDING;
+  if (tis.seized & 1 << locality)
+    value |= TIS_ACCESS_SEIZED;
+  return value;
+}
+
+static unsigned int intf_capability(void) {
+  // dataAvail, stsValid, localityChange and commandReady interrupts
+  unsigned int cap = 0x87;
+
+  if (tis.fifo_width == 4)
+    cap |= TIS_INTF_VERSION_1_3 << TIS_INTF_VERSION_SHIFT |
+           3 << TIS_INTF_TRANSFER_SIZE_SHIFT;
+  return cap;
+}
+
+/* Count the access and let it take its time */
+static void bus_cycle(void) {
+  tis_emu_accesses++;
+  if (tis_emu_access_ns) {
+    UINT64 until = now_ns() + tis_emu_access_ns;
+    while (now_ns() < until)
+      ;
+  }
+  if (tis.state == EMU_EXECUTION && now_ns() >= tis.done_ns)
+    tis.state = EMU_COMPLETION;
+}
+
+unsigned int tis_host_read(unsigned long addr, unsigned int size) {
+  unsigned int locality = (addr - TIS_BASE) >> 12;
+  unsigned int reg = (addr - TIS_BASE) & 0xfff;
+  unsigned int value = 0;
+
+  bus_cycle();
+  if (locality >= EMU_LOCALITIES)
+    return ~0u;
+  bool active = tis.active == (int)locality;
+
+  switch (reg) {
+  case REG_ACCESS:
+    return access_read(locality);
+  case REG_INT_ENABLE:
+    return tis.int_enable[locality];
+  case REG_INT_VECTOR:
+    return tis.int_vector[locality];
+  case REG_INT_STATUS:
+    return 0;
+  case REG_INTF_CAPABILITY:
+    return intf_capability();
+  case REG_STS:
+    return active ? sts() : 0xff;
+  case REG_BURST_COUNT:
+    return active ? burst_count() & 0xff : 0xff;
+  case REG_BURST_COUNT + 1:
+    return active ? burst_count() >> 8 : 0xff;
+  case REG_DATA_FIFO:
+    if (!active || tis.state != EMU_COMPLETION ||
+        (size > 1 && tis.fifo_width < size))
+      return ~0u;
+    for (unsigned i = 0; i < size; i++, tis.response_pos++)
+      value |= (unsigned int)(tis.response_pos < tis.response_size
+                                  ? tis.response[tis.response_pos]
+                                  : 0xff)
+               << 8 * i;
+    return value;
+  case REG_DID_VID:
+    return 0xb15d1; // Infineon
+  case REG_RID:
+    return 0x10;
+  default:
+    return 0;
+  }
+}
+
+void tis_host_write(unsigned long addr, unsigned int size, unsigned int value) {
+  unsigned int locality = (addr - TIS_BASE) >> 12;
+  unsigned int reg = (addr - TIS_BASE) & 0xfff;
+
+  bus_cycle();
+  if (locality >= EMU_LOCALITIES)
+    return;
+  if (reg == REG_ACCESS) {
+    access_write(locality, value);
+    return;
+  }
+  // the other registers belong to the active locality
+  if (tis.active != (int)locality)
+    return;
+
+  switch (reg) {
+  case REG_INT_ENABLE:
+    tis.int_enable[locality] = value;
+    break;
+  case REG_INT_VECTOR:
+    tis.int_vector[locality] = value;
+    break;
+  case REG_STS:
+    sts_write(locality, value);
+    break;
+  case REG_DATA_FIFO:
+    if (size > 1 && tis.fifo_width < size)
+      break;
+    if (tis.state == EMU_READY) {
+      tis.state = EMU_RECEPTION;
+      tis.received = 0;
+    }
+    for (unsigned i = 0; tis.state == EMU_RECEPTION && i < size; i++)
+      if (tis.received < sizeof(tis.command))
+        tis.command[tis.received++] = value >> 8 * i;
+    break;
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef __TIS_EMU_H__
+#define __TIS_EMU_H__
+
+/*
+ * \brief   header of tis_emu.c
+ */
+
+#include "platform.h"
+
+/* Power on the interface. A fifo_width of 4 makes it a TIS 1.3 interface
+ * that allows 4 byte accesses to the data FIFO. */
+void tis_emu_reset(unsigned int fifo_width);
+
+/* the time every register access takes, in nanoseconds */
+extern UINT32 tis_emu_access_ns;
+/* register accesses since the reset */
+extern UINT32 tis_emu_accesses;
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * \brief   End-to-end benchmark of SABLE against a TPM model.
+ *
+ * tis.c, tpm.c and sable.c run unchanged on top of an emulated TIS interface
+ * (tis_emu.c) in front of a TPM 1.2 model (tpm_model.c). Every boot runs in
+ * a child process, like after a reboot: SABLE starts from scratch, while the
+ * NV space of the TPM survives in shared memory. A boot measures the way
+ * post_launch() does and then times configure() or trusted_boot(), which get
+ * their passwords from a script. Another boot writes and reads back a NV
+ * object that takes several commands, yet another one runs many trusted boots
+ * in the same heap. The launch itself is timed with and without the
+ * TPM_ContinueSelfTest of pre_launch().
+ *
+ * Arguments of the form Name=us replace the execution time of a command,
+ * e.g. Unseal=200000, iterations=N sets the boots per timed measurement and
+ * mmio_ns=N the time of a register access. The results are written to stdout
+ * as CSV, the exit status is non-zero if a boot did not end as expected.
+ */
+
+#include "platform.h"
+#include "alloc.h"
+#include "heap.h"
+#include "sha.h"
+#include "tcg.h"
+#include "tis.h"
+#include "tpm.h"
+#include "util.h"
+#include "shim.h"
+#include "tis_emu.h"
+#include "tpm_model.h"
+
+#define NV_INDEX 4
+#define NV_SIZE 384
+/* the NV space of the TPM, SABLE only uses the first NV_SIZE bytes */
+#define NV_SPACE 4096
+/* a NV object larger than the TIS buffers */
+#define NV_BLOB_SIZE 3000
+/* the size of heap_array in sable.c */
+#define SABLE_HEAP_SIZE (8 * 1024)
+/* trusted boots in one heap, more than fit into it without freeing */
+#define REPEATED_BOOTS 200
+/* boots per measurement without and with execution times */
+#define EMU_ITERATIONS 20
+#define LATENCY_ITERATIONS 3
+/* a register access on the LPC bus */
+#define MMIO_NS 1000
+/* what the CPU does between pre_launch() and post_launch() when the TPM
+ * takes its time, without the 1 s wait for the APs on AMD */
+#define LAUNCH_PREP_US 100000
+
+extern BYTE heap_array[];
+RESULT configure(UINT32 index, UINT32 size);
+RESULT trusted_boot(UINT32 index, UINT32 size);
+RESULT_(TPM_NONCE) get_nonce(void);
+
+enum boot_kind {
+  BOOT_CONFIGURE,
+  BOOT_TRUSTED,
+  BOOT_TAMPERED,
+  BOOT_WRONG_PASSWORD,
+  BOOT_NV_BLOB,
+  BOOT_REPEATED,
+  BOOT_LAUNCH,
+  BOOT_LAUNCH_UNTESTED, // without TPM_ContinueSelfTest
+};
+
+static const char passphrase[] = "correct horse battery staple";
+static const char pp_password[] = "passphrase password";
+static const char nv_password[] = "nv password";
+
+/* the answers to the prompts, the empty SRK password is the well-known one */
+static const char *const configure_script[] = {passphrase, pp_password, "",
+                                               nv_password, NULL};
+static const char *const trusted_boot_script[] = {pp_password, "", "YES",
+                                                  NULL};
+static const char *const wrong_password_script[] = {"guess", "", "YES", NULL};
+static const char *const *script;
+
+/* the command line and the modules that a boot measures */
+static const char *const modules[] = {
+    "--nv-index=4 --nv-size=384", "cleanup", "core.img", "vmlinuz", "initrd",
+};
+
+/* written by the child of a boot */
+static struct {
+  UINT64 ns;
+  UINT32 commands;
+  UINT32 mmio;
+} *result;
+
+static unsigned failures;
+static UINT32 launch_prep_us;
+
+int get_string(char *str, unsigned int strSize, bool show) {
+  const char *answer = script && *script ? *script++ : "";
+  UINT32 len = strlen(answer);
+
+  (void)show;
+  if (len > strSize)
+    len = strSize;
+  memcpy(str, answer, len);
+  str[len] = 0;
+  return len;
+}
+
+void reboot(void) {
+  // trusted_boot() did not get a YES
+  exit(3);
+}
+
+static TPM_DIGEST digest_of(const char *s) {
+  SHA1_Context ctx;
+
+  sha1_init(&ctx);
+  sha1_stream(&ctx, s, strlen(s));
+  sha1_finish(&ctx);
+  return ctx.hash;
+}
+
+/**
+ * What the BIOS, pre_launch() and post_launch() do before SABLE asks whether
+ * to configure.
+ */
+static RESULT launch(enum boot_kind kind) {
+  RESULT ret = {.exception.error = NONE};
+  UINT32 timeouts[4];
+
+  ERROR(tis_init() != TIS_INIT_INFINEON, ERROR_BAD_TPM_VENDOR, "no TPM");
+  RESULT res = tis_access(TIS_LOCALITY_0, 0);
+  THROW(res.exception);
+  res = TPM_Startup(TPM_ST_CLEAR);
+  THROW(res.exception);
+  res = TPM_GetCapability(TPM_CAP_PROPERTY, TPM_CAP_PROP_TIS_TIMEOUT, timeouts,
+                          4);
+  THROW(res.exception);
+  tis_set_timeouts(TIS_TIMEOUT_A, timeouts, 4);
+  res = TPM_GetCapability(TPM_CAP_PROPERTY, TPM_CAP_PROP_DURATION, timeouts,
+                          3);
+  THROW(res.exception);
+  tis_set_timeouts(TIS_DURATION_SHORT, timeouts, 3);
+  if (kind != BOOT_LAUNCH_UNTESTED) {
+    res = TPM_ContinueSelfTest_submit();
+    THROW(res.exception);
+  }
+  res = tis_deactivate_all();
+  THROW(res.exception);
+
+  UINT64 until = now_ns() + (UINT64)launch_prep_us * 1000;
+  while (now_ns() < until)
+    ;
+  tpm_model_launch(digest_of("SLB"));
+  tpm_cache_reset();
+  res = tis_access(TIS_LOCALITY_2, 0);
+  THROW(res.exception);
+  for (unsigned i = 0; i < sizeof(modules) / sizeof(modules[0]); i++) {
+    const char *module =
+        kind == BOOT_TAMPERED && i == 3 ? "another kernel" : modules[i];
+    RESULT_(TPM_PCRVALUE) pcr = TPM_Extend(19, digest_of(module));
+    THROW(pcr.exception);
+  }
+  return ret;
+}
+
+/* Write a NV object larger than the TIS buffers and read it back, a larger
+ * one does not fit into the heap */
+static RESULT nv_blob(void) {
+  RESULT ret = {.exception.error = NONE};
+  static BYTE blob[NV_BLOB_SIZE];
+  TPM_SESSION *session = NULL;
+
+  for (UINT32 i = 0; i < NV_BLOB_SIZE; i++)
+    blob[i] = i * 7 + 1;
+  RESULT_(TPM_NONCE) nonceOdd = get_nonce();
+  THROW(nonceOdd.exception);
+  RESULT res = tpm_session_oiap(&session, nonceOdd.value);
+  THROW(res.exception);
+  res = tpm_nv_write(blob, NV_BLOB_SIZE, NV_INDEX,
+                     *(TPM_AUTHDATA *)digest_of(nv_password).digest, &session,
+                     get_nonce);
+  THROW(res.exception);
+  ERROR(session, ERROR_TPM_BAD_OUTPUT_PARAM, "NV session still open");
+  RESULT_(DATA_VIEW) read = tpm_nv_read(NV_INDEX, NV_BLOB_SIZE);
+  THROW(read.exception);
+  ERROR(read.value.dataSize != NV_BLOB_SIZE ||
+            memcmp(read.value.data, blob, NV_BLOB_SIZE),
+        ERROR_TPM_BAD_OUTPUT_PARAM, "NV object differs");
+
+  // more than the heap holds, nothing may be read to address 0
+  read = tpm_nv_read(NV_INDEX, SABLE_HEAP_SIZE);
+  ERROR(read.exception.error != ERROR_BUFFER_OVERFLOW,
+        ERROR_TPM_BAD_OUTPUT_PARAM, "NV object larger than the heap");
+  return ret;
+}
+
+/* Trusted boots one after the other, each in a heap scope like in
+ * post_launch() */
+static RESULT repeated_boots(void) {
+  RESULT ret = {.exception.error = NONE};
+
+  // post_launch() takes the nonce pool from the heap before the scope
+  RESULT_(TPM_NONCE) nonce = get_nonce();
+  THROW(nonce.exception);
+  for (unsigned i = 0; i < REPEATED_BOOTS; i++) {
+    UINT32 scope = heap_mark();
+    script = trusted_boot_script;
+    RESULT res = trusted_boot(NV_INDEX, NV_SIZE);
+    THROW(res.exception);
+    heap_release(heap, scope);
+  }
+  return ret;
+}
+
+/* A boot in the child, returns its exit status */
+static int boot(enum boot_kind kind) {
+  tpm_model_boot();
+  init_heap(heap, SABLE_HEAP_SIZE);
+  shim_quiet = true;
+  UINT32 commands = tpm_model_stats->commands;
+  UINT32 mmio = tis_emu_accesses;
+  UINT64 start = now_ns();
+  RESULT res = launch(kind);
+  if (res.exception.error)
+    return 1;
+  if (kind == BOOT_LAUNCH || kind == BOOT_LAUNCH_UNTESTED) {
+    result->ns = now_ns() - start;
+    result->commands = tpm_model_stats->commands - commands;
+    result->mmio = tis_emu_accesses - mmio;
+    return 0;
+  }
+
+  commands = tpm_model_stats->commands;
+  mmio = tis_emu_accesses;
+  tpm_model_stats->unsealed_size = 0;
+  tpm_model_stats->reused_nonces = 0;
+  script = kind == BOOT_CONFIGURE        ? configure_script
+           : kind == BOOT_WRONG_PASSWORD ? wrong_password_script
+                                         : trusted_boot_script;
+  start = now_ns();
+  res = kind == BOOT_CONFIGURE ? configure(NV_INDEX, NV_SIZE)
+        : kind == BOOT_NV_BLOB ? nv_blob()
+        : kind == BOOT_REPEATED
+            ? repeated_boots()
+            : trusted_boot(NV_INDEX, NV_SIZE);
+  result->ns = now_ns() - start;
+  result->commands = tpm_model_stats->commands - commands;
+  result->mmio = tis_emu_accesses - mmio;
+  if (res.exception.error || tpm_model_stats->reused_nonces)
+    return 1;
+
+  // the model keeps what it unsealed
+  if (kind != BOOT_CONFIGURE && kind != BOOT_NV_BLOB &&
+      (tpm_model_stats->unsealed_size != sizeof(passphrase) ||
+       memcmp(tpm_model_stats->unsealed, passphrase, sizeof(passphrase))))
+    return 1;
+  return 0;
+}
+
+static int run_boot(enum boot_kind kind) {
+  int pid = shim_fork();
+
+  if (!pid)
+    exit(boot(kind));
+  return pid < 0 ? -1 : shim_wait(pid);
+}
+
+static void check(const char *what, enum boot_kind kind, bool works) {
+  if ((run_boot(kind) == 0) != works) {
+    out_info("check failed:");
+    out_info(what);
+    failures++;
+  }
+}
+
+static void bench(const char *suite, const char *name, enum boot_kind kind,
+                  UINT32 param, UINT32 iterations) {
+  UINT64 ns = 0, commands = 0, mmio = 0;
+
+  for (UINT32 i = 0; i < iterations; i++) {
+    if (run_boot(kind)) {
+      out_info("boot failed:");
+      out_info(name);
+      failures++;
+      return;
+    }
+    ns += result->ns;
+    commands += result->commands;
+    mmio += result->mmio;
+  }
+  out_string(suite);
+  out_string(",");
+  out_string(name);
+  out_string(",");
+  out_u64(param);
+  out_string(",");
+  out_u64(iterations);
+  out_string(",");
+  out_u64(div64(ns, iterations));
+  out_string(",");
+  out_u64(div64(commands, iterations));
+  out_string(",");
+  out_u64(div64(mmio, iterations));
+  out_string("\n");
+}
+
+static UINT32 parse_u32(const char *s, bool *ok) {
+  UINT32 value = 0;
+
+  *ok = *s;
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9')
+      *ok = false;
+    value = value * 10 + (*s - '0');
+  }
+  return value;
+}
+
+int main(int argc, char **argv) {
+  UINT32 iterations = LATENCY_ITERATIONS, mmio_ns = MMIO_NS;
+  static const UINT32 widths[] = {1, 4};
+  char name[32];
+
+  result = shim_shared(sizeof(*result));
+  if (!result)
+    return 1;
+  tpm_model_init(NV_INDEX, NV_SPACE,
+                 *(TPM_AUTHDATA *)digest_of(nv_password).digest);
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    UINT32 len = 0;
+    bool ok;
+    while (arg[len] && arg[len] != '=' && len < sizeof(name) - 1)
+      len++;
+    memcpy(name, arg, len);
+    name[len] = 0;
+    UINT32 value = parse_u32(arg + len + (arg[len] == '='), &ok);
+    if (ok && !memcmp(name, "iterations", sizeof("iterations")))
+      iterations = value ? value : 1;
+    else if (ok && !memcmp(name, "mmio_ns", sizeof("mmio_ns")))
+      mmio_ns = value;
+    else if (!ok || !tpm_model_set_latency(name, value)) {
+      out_info("usage: sable-tpm-bench [<Ordinal>=us] [iterations=N] "
+               "[mmio_ns=N]");
+      return 2;
+    }
+  }
+
+  out_string("suite,case,param,iterations,ns_per_op,commands,mmio\n");
+  for (unsigned i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+    // every child starts with this interface and the latencies of the suite
+    tis_emu_reset(widths[i]);
+    tis_emu_access_ns = 0;
+    tpm_model_timed(false);
+
+    check("configure", BOOT_CONFIGURE, true);
+    check("trusted boot", BOOT_TRUSTED, true);
+    check("trusted boot with another kernel", BOOT_TAMPERED, false);
+    check("trusted boot with a wrong password", BOOT_WRONG_PASSWORD, false);
+    check("trusted boot after a failed one", BOOT_TRUSTED, true);
+    check("trusted boots in one heap", BOOT_REPEATED, true);
+
+    bench("tpm_emu", "configure", BOOT_CONFIGURE, widths[i], EMU_ITERATIONS);
+    bench("tpm_emu", "trusted_boot", BOOT_TRUSTED, widths[i], EMU_ITERATIONS);
+
+    tis_emu_access_ns = mmio_ns;
+    tpm_model_timed(true);
+    bench("tpm_latency", "configure", BOOT_CONFIGURE, widths[i], iterations);
+    bench("tpm_latency", "trusted_boot", BOOT_TRUSTED, widths[i], iterations);
+    launch_prep_us = LAUNCH_PREP_US;
+    bench("tpm_latency", "launch", BOOT_LAUNCH, widths[i], iterations);
+    bench("tpm_latency", "launch_untested", BOOT_LAUNCH_UNTESTED, widths[i],
+          iterations);
+    launch_prep_us = 0;
+
+    // last, it overwrites the sealed passphrase
+    tis_emu_access_ns = 0;
+    tpm_model_timed(false);
+    check("NV object of several commands", BOOT_NV_BLOB, true);
+    bench("tpm_emu", "nv_blob", BOOT_NV_BLOB, widths[i], EMU_ITERATIONS);
+  }
+
+  return failures ? 1 : 0;
+}
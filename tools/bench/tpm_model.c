@@ -0,0 +1,751 @@
+/*
+ * \brief   A TPM 1.2 for sable-tpm-bench.
+ *
+ * The model executes the commands SABLE sends, with the OIAP and OSAP
+ * authorization of the TPM 1.2 main specification. The SRK is no RSA key:
+ * sealed data is masked with the tpmProof of the model instead, but it is
+ * bound to the PCRs and the locality of its TPM_PCR_INFO_LONG and to its
+ * authorization data like on a real TPM, so a wrong PCR value or password
+ * makes TPM_Unseal fail.
+ *
+ * The state that survives a reboot lives in memory shared with the forked
+ * children, so that the NV space written by one boot is read by the next.
+ */
+
+#include "platform.h"
+#include "hmac.h"
+#include "mgf1.h"
+#include "sha.h"
+#include "tcg.h"
+#include "tpm_struct.h"
+#include "util.h"
+#include "shim.h"
+#include "tpm_model.h"
+
+#define PCR_COUNT 24
+#define SESSION_COUNT 3
+#define NV_MAX 4096
+#define INPUT_BUFFER_SIZE 1280
+#define FIRST_AUTH_HANDLE 0x02000000
+#define HEADER_SIZE 10
+/* authHandle, nonceOdd, continueAuthSession and the HMAC of a session */
+#define AUTH_TRAILER_SIZE                                                      \
+  (sizeof(UINT32) + sizeof(TPM_NONCE) + 1 + sizeof(TPM_AUTHDATA))
+
+struct session {
+  TPM_AUTHHANDLE handle; // zero if the slot is free
+  bool osap;
+  TPM_NONCE nonceEven;
+  bool authorized;    // nonceOdd is the one of the last command
+  TPM_NONCE nonceOdd; // to catch a reused one
+  TPM_SECRET secret;  // the shared secret of an OSAP session
+};
+
+/* the state that survives a reboot */
+static struct {
+  TPM_NV_INDEX nv_index;
+  UINT32 nv_size;
+  TPM_AUTHDATA nv_auth;
+  BYTE nv[NV_MAX];
+  TPM_SECRET proof;
+  UINT32 random;
+  struct tpm_model_stats stats;
+} *tpm;
+
+/* the state that a reboot clears */
+static struct {
+  bool started;
+  bool tested; // the self-test has run
+  TPM_PCRVALUE pcr[PCR_COUNT];
+  struct session sessions[SESSION_COUNT];
+  TPM_AUTHHANDLE next_handle;
+} state;
+
+struct tpm_model_stats *tpm_model_stats;
+
+/* the well-known secret */
+static const TPM_AUTHDATA srk_auth;
+
+/* the localities that may extend a PCR, from the PC Client specification */
+static const BYTE pcr_extend_localities[PCR_COUNT] = {
+    [0 ... 16] = 0x1f, [17] = 0x10, [18] = 0x18, [19] = 0x1c,
+    [20] = 0x1e,       [21] = 0x04, [22] = 0x04, [23] = 0x1f,
+};
+
+static const UINT32 tis_timeouts[] = {750000, 2000000, 750000, 750000};
+static const UINT32 durations[] = {1000000, 10000000, 60000000};
+static const UINT32 input_buffer_size = INPUT_BUFFER_SIZE;
+
+/* the plaintext of the encData of a sealed blob */
+struct sealed {
+  TPM_DIGEST info_digest;
+  TPM_AUTHDATA auth;
+  BYTE sealx;
+  BYTE data[sizeof(((struct tpm_model_stats *)0)->unsealed)];
+};
+#define SEALED_HEADER_SIZE __builtin_offsetof(struct sealed, data)
+
+struct auth {
+  struct session *session;
+  TPM_NONCE nonceOdd;
+  BYTE continueAuthSession;
+  TPM_AUTHDATA hmac;
+  TPM_SECRET key;
+};
+
+struct request {
+  unsigned int locality;
+  TPM_COMMAND_CODE ordinal;
+  unsigned int auths;
+  Unpack_Context in;
+  Pack_Context out;
+  SHA1_Context in_digest;  // of the ordinal and the parameters
+  SHA1_Context out_digest; // of the result, the ordinal and the parameters
+  struct auth auth[2];
+};
+
+static void random_bytes(void *buffer, UINT32 size) {
+  BYTE *p = buffer;
+
+  // xorshift32, good enough for nonces that nobody attacks
+  while (size--) {
+    UINT32 x = tpm->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tpm->random = x;
+    *p++ = x;
+  }
+}
+
+/**
+ * Returns size bytes of the parameters, which have to leave reserve bytes
+ * for the fixed size parameters behind them, or NULL.
+ */
+static const BYTE *take(struct request *r, UINT32 size, UINT32 reserve) {
+  const BYTE *p = r->in.unpack_buffer + r->in.bytes_unpacked;
+  UINT32 left = r->in.size - r->in.bytes_unpacked;
+
+  if (left < reserve || size > left - reserve)
+    return NULL;
+  unmarshal_array(NULL, size, &r->in, NULL);
+  sha1_stream(&r->in_digest, p, size);
+  return p;
+}
+
+static UINT16 get_UINT16(const BYTE *p) { return p[0] << 8 | p[1]; }
+
+static void pcr_extend(TPM_PCRINDEX index, TPM_DIGEST digest) {
+  SHA1_Context ctx;
+
+  sha1_init(&ctx);
+  sha1_stream(&ctx, &state.pcr[index], sizeof(TPM_PCRVALUE));
+  sha1_stream(&ctx, &digest, sizeof(TPM_DIGEST));
+  sha1_finish(&ctx);
+  state.pcr[index] = ctx.hash;
+}
+
+/* offsets into a TPM_PCR_INFO_LONG */
+struct pcr_info {
+  UINT32 creation; // of creationPCRSelection
+  UINT32 release;  // of releasePCRSelection
+  UINT32 digests;  // of digestAtCreation, digestAtRelease follows
+};
+
+static bool pcr_info_parse(const BYTE *p, UINT32 size, struct pcr_info *info) {
+  if (size < 6 || get_UINT16(p) != TPM_TAG_PCR_INFO_LONG)
+    return false;
+  info->creation = 4;
+  info->release = info->creation + 2 + get_UINT16(p + info->creation);
+  if (info->release + 2 > size)
+    return false;
+  info->digests = info->release + 2 + get_UINT16(p + info->release);
+  return info->digests + 2 * sizeof(TPM_DIGEST) == size;
+}
+
+/* the composite hash of the PCRs in the TPM_PCR_SELECTION at p */
+static TPM_COMPOSITE_HASH pcr_composite(const BYTE *p) {
+  TPM_PCRVALUE values[PCR_COUNT];
+  UINT16 size = get_UINT16(p);
+  UINT32 count = 0;
+
+  for (UINT32 i = 0; i < PCR_COUNT && i / 8 < size; i++)
+    if (p[2 + i / 8] >> (i % 8) & 1)
+      values[count++] = state.pcr[i];
+  TPM_PCR_COMPOSITE comp = {
+      .select = {.sizeOfSelect = size, .pcrSelect = (BYTE *)p + 2},
+      .valueSize = count * sizeof(TPM_PCRVALUE),
+      .pcrValue = values};
+  return get_TPM_COMPOSITE_HASH(comp);
+}
+
+static struct session *session_find(TPM_AUTHHANDLE handle) {
+  for (unsigned i = 0; handle && i < SESSION_COUNT; i++)
+    if (state.sessions[i].handle == handle)
+      return state.sessions + i;
+  return NULL;
+}
+
+static struct session *session_open(bool osap) {
+  struct session *s = NULL;
+
+  for (unsigned i = 0; !s && i < SESSION_COUNT; i++)
+    if (!state.sessions[i].handle)
+      s = state.sessions + i;
+  if (s) {
+    s->handle = state.next_handle++;
+    s->osap = osap;
+    s->authorized = false;
+    random_bytes(&s->nonceEven, sizeof(TPM_NONCE));
+  }
+  return s;
+}
+
+static TPM_AUTHDATA auth_hmac(const struct auth *a, const SHA1_Context *digest,
+                              const TPM_NONCE *nonceEven) {
+  HMAC_Context ctx;
+
+  hmac_init(&ctx, a->key.authdata, sizeof(TPM_SECRET));
+  hmac(&ctx, &digest->hash, sizeof(TPM_DIGEST));
+  hmac(&ctx, nonceEven, sizeof(TPM_NONCE));
+  hmac(&ctx, &a->nonceOdd, sizeof(TPM_NONCE));
+  hmac(&ctx, &a->continueAuthSession, 1);
+  hmac_finish(&ctx);
+  return *(TPM_AUTHDATA *)&ctx.sctx.hash;
+}
+
+/* Read the authorization sessions behind the parameters */
+static TPM_RESULT auth_begin(struct request *r) {
+  if (r->in.bytes_unpacked != r->in.size)
+    return TPM_E_BAD_PARAM_SIZE;
+  sha1_finish(&r->in_digest);
+  r->in.size += r->auths * AUTH_TRAILER_SIZE;
+  for (unsigned i = 0; i < r->auths; i++) {
+    struct auth *a = r->auth + i;
+    UINT32 handle;
+    unmarshal_UINT32(&handle, &r->in, NULL);
+    unmarshal_array(&a->nonceOdd, sizeof(TPM_NONCE), &r->in, NULL);
+    unmarshal_BYTE(&a->continueAuthSession, &r->in, NULL);
+    unmarshal_array(&a->hmac, sizeof(TPM_AUTHDATA), &r->in, NULL);
+    a->session = session_find(handle);
+    if (!a->session)
+      return TPM_E_INVALID_AUTHHANDLE;
+    // a real TPM accepts it, but the response could then be replayed
+    if (a->session->authorized &&
+        !memcmp(&a->nonceOdd, &a->session->nonceOdd, sizeof(TPM_NONCE)))
+      tpm->stats.reused_nonces++;
+    a->session->authorized = true;
+    a->session->nonceOdd = a->nonceOdd;
+  }
+  return TPM_SUCCESS;
+}
+
+/**
+ * Check session i against the usage secret of the entity, or the shared
+ * secret if it is an OSAP session. The first call reads the sessions.
+ */
+static TPM_RESULT auth_check(struct request *r, unsigned int i,
+                             const TPM_SECRET *usage) {
+  struct auth *a = r->auth + i;
+
+  if (!i) {
+    TPM_RESULT res = auth_begin(r);
+    if (res)
+      return res;
+  }
+  a->key = a->session->osap ? a->session->secret : *usage;
+  TPM_AUTHDATA expected = auth_hmac(a, &r->in_digest, &a->session->nonceEven);
+  if (memcmp(&expected, &a->hmac, sizeof(TPM_AUTHDATA)))
+    return i ? TPM_E_AUTH2FAIL : TPM_E_AUTHFAIL;
+  return TPM_SUCCESS;
+}
+
+/* Append the authorization of the response for every session */
+static TPM_RESULT auth_reply(struct request *r) {
+  sha1_finish(&r->out_digest);
+  for (unsigned i = 0; i < r->auths; i++) {
+    struct auth *a = r->auth + i;
+    struct session *s = a->session;
+    random_bytes(&s->nonceEven, sizeof(TPM_NONCE));
+    TPM_AUTHDATA resAuth = auth_hmac(a, &r->out_digest, &s->nonceEven);
+    marshal_array(&s->nonceEven, sizeof(TPM_NONCE), &r->out, NULL);
+    marshal_BYTE(a->continueAuthSession, &r->out, NULL);
+    marshal_array(&resAuth, sizeof(TPM_AUTHDATA), &r->out, NULL);
+    if (!a->continueAuthSession)
+      s->handle = 0;
+  }
+  return TPM_SUCCESS;
+}
+
+/**
+ * Mask data with the MGF1 output for nonceEven, nonceOdd, "XOR" and the
+ * shared secret of an OSAP session, as TPM_Sealx and TPM_Unseal do.
+ */
+static void sealx_mask(const struct auth *a, BYTE *data, UINT32 size) {
+  BYTE seed[2 * sizeof(TPM_NONCE) + 3 + sizeof(TPM_SECRET)];
+
+  memcpy(seed, &a->session->nonceEven, sizeof(TPM_NONCE));
+  memcpy(seed + sizeof(TPM_NONCE), &a->nonceOdd, sizeof(TPM_NONCE));
+  memcpy(seed + 2 * sizeof(TPM_NONCE), xor_str, 3);
+  memcpy(seed + 2 * sizeof(TPM_NONCE) + 3, &a->session->secret,
+         sizeof(TPM_SECRET));
+  mgf1_xor(seed, sizeof(seed), data, size);
+}
+
+static TPM_RESULT startup(struct request *r) {
+  TPM_STARTUP_TYPE type;
+
+  unmarshal_UINT16(&type, &r->in, NULL);
+  if (state.started)
+    return TPM_E_INVALID_POSTINIT;
+  if (type != TPM_ST_CLEAR)
+    return TPM_E_BAD_PARAMETER;
+  state.started = true;
+  return TPM_SUCCESS;
+}
+
+/* The self-test itself is its execution time */
+static TPM_RESULT continue_self_test(struct request *r) {
+  (void)r;
+  state.tested = true;
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT get_capability(struct request *r) {
+  UINT32 area, sub_size, count;
+  const UINT32 *values;
+
+  unmarshal_UINT32(&area, &r->in, NULL);
+  unmarshal_UINT32(&sub_size, &r->in, NULL);
+  const BYTE *sub = take(r, sub_size, 0);
+  if (!sub)
+    return TPM_E_BAD_PARAM_SIZE;
+  if (area != TPM_CAP_PROPERTY || sub_size != sizeof(UINT32))
+    return TPM_E_BAD_MODE;
+
+  switch ((UINT32)get_UINT16(sub) << 16 | get_UINT16(sub + 2)) {
+  case TPM_CAP_PROP_TIS_TIMEOUT:
+    values = tis_timeouts;
+    count = sizeof(tis_timeouts) / sizeof(UINT32);
+    break;
+  case TPM_CAP_PROP_DURATION:
+    values = durations;
+    count = sizeof(durations) / sizeof(UINT32);
+    break;
+  case TPM_CAP_PROP_INPUT_BUFFER:
+    values = &input_buffer_size;
+    count = 1;
+    break;
+  default:
+    return TPM_E_BAD_MODE;
+  }
+  marshal_UINT32(count * sizeof(UINT32), &r->out, NULL);
+  for (UINT32 i = 0; i < count; i++)
+    marshal_UINT32(values[i], &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT pcr_read(struct request *r) {
+  TPM_PCRINDEX index;
+
+  unmarshal_UINT32(&index, &r->in, NULL);
+  if (index >= PCR_COUNT)
+    return TPM_E_BADINDEX;
+  marshal_array(&state.pcr[index], sizeof(TPM_PCRVALUE), &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT extend(struct request *r) {
+  TPM_PCRINDEX index;
+  TPM_DIGEST digest;
+
+  unmarshal_UINT32(&index, &r->in, NULL);
+  unmarshal_array(&digest, sizeof(TPM_DIGEST), &r->in, NULL);
+  if (index >= PCR_COUNT)
+    return TPM_E_BADINDEX;
+  if (!(pcr_extend_localities[index] & 1 << r->locality))
+    return TPM_E_BAD_LOCALITY;
+  pcr_extend(index, digest);
+  marshal_array(&state.pcr[index], sizeof(TPM_PCRVALUE), &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT get_random(struct request *r) {
+  UINT32 size, room = r->out.size - r->out.bytes_packed - sizeof(UINT32);
+
+  // the TPM may return fewer bytes than requested
+  unmarshal_UINT32(&size, &r->in, NULL);
+  if (size > room)
+    size = room;
+  marshal_UINT32(size, &r->out, NULL);
+  random_bytes(r->out.pack_buffer + r->out.bytes_packed, size);
+  r->out.bytes_packed += size;
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT oiap(struct request *r) {
+  struct session *s = session_open(false);
+
+  if (!s)
+    return TPM_E_RESOURCES;
+  marshal_UINT32(s->handle, &r->out, NULL);
+  marshal_array(&s->nonceEven, sizeof(TPM_NONCE), &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT osap(struct request *r) {
+  TPM_ENTITY_TYPE type;
+  UINT32 value;
+  TPM_NONCE nonceOddOSAP, nonceEvenOSAP;
+
+  unmarshal_UINT16(&type, &r->in, NULL);
+  unmarshal_UINT32(&value, &r->in, NULL);
+  unmarshal_array(&nonceOddOSAP, sizeof(TPM_NONCE), &r->in, NULL);
+  if (type != TPM_ET_KEYHANDLE)
+    return TPM_E_BAD_PARAMETER;
+  if (value != TPM_KH_SRK)
+    return TPM_E_INVALID_KEYHANDLE;
+
+  struct session *s = session_open(true);
+  if (!s)
+    return TPM_E_RESOURCES;
+  random_bytes(&nonceEvenOSAP, sizeof(TPM_NONCE));
+  s->secret = sharedSecret_gen(srk_auth, nonceEvenOSAP, nonceOddOSAP);
+  marshal_UINT32(s->handle, &r->out, NULL);
+  marshal_array(&s->nonceEven, sizeof(TPM_NONCE), &r->out, NULL);
+  marshal_array(&nonceEvenOSAP, sizeof(TPM_NONCE), &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT flush_specific(struct request *r) {
+  TPM_HANDLE handle;
+  TPM_RESOURCE_TYPE type;
+
+  unmarshal_UINT32(&handle, &r->in, NULL);
+  unmarshal_UINT32(&type, &r->in, NULL);
+  if (type != TPM_RT_AUTH)
+    return TPM_E_BAD_PARAMETER;
+  struct session *s = session_find(handle);
+  if (!s)
+    return TPM_E_INVALID_AUTHHANDLE;
+  s->handle = 0;
+  return TPM_SUCCESS;
+}
+
+static TPM_RESULT nv_write_value_auth(struct request *r) {
+  TPM_NV_INDEX index;
+  UINT32 offset, size;
+
+  unmarshal_UINT32(&index, &r->in, &r->in_digest);
+  unmarshal_UINT32(&offset, &r->in, &r->in_digest);
+  unmarshal_UINT32(&size, &r->in, &r->in_digest);
+  const BYTE *data = take(r, size, 0);
+  if (!data)
+    return TPM_E_BAD_PARAM_SIZE;
+  TPM_RESULT res = auth_check(r, 0, &tpm->nv_auth);
+  if (res)
+    return res;
+  if (index != tpm->nv_index)
+    return TPM_E_BADINDEX;
+  if (offset > tpm->nv_size || size > tpm->nv_size - offset)
+    return TPM_E_NOSPACE;
+  memcpy(tpm->nv + offset, data, size);
+  return auth_reply(r);
+}
+
+static TPM_RESULT nv_read_value(struct request *r) {
+  TPM_NV_INDEX index;
+  UINT32 offset, size;
+
+  unmarshal_UINT32(&index, &r->in, NULL);
+  unmarshal_UINT32(&offset, &r->in, NULL);
+  unmarshal_UINT32(&size, &r->in, NULL);
+  if (index != tpm->nv_index)
+    return TPM_E_BADINDEX;
+  if (offset > tpm->nv_size || size > tpm->nv_size - offset)
+    return TPM_E_NOSPACE;
+  // the response has to fit into the buffer as well
+  if (size > INPUT_BUFFER_SIZE - HEADER_SIZE - sizeof(UINT32))
+    return TPM_E_SIZE;
+  marshal_UINT32(size, &r->out, NULL);
+  marshal_array(tpm->nv + offset, size, &r->out, NULL);
+  return TPM_SUCCESS;
+}
+
+/* TPM_Seal and TPM_Sealx */
+static TPM_RESULT seal(struct request *r) {
+  TPM_KEY_HANDLE key;
+  TPM_ENCAUTH encAuth;
+  UINT32 info_size, size;
+  struct pcr_info pi;
+  struct sealed blob;
+  BYTE info[128];
+
+  unmarshal_UINT32(&key, &r->in, NULL);
+  unmarshal_array(&encAuth, sizeof(TPM_ENCAUTH), &r->in, &r->in_digest);
+  unmarshal_UINT32(&info_size, &r->in, &r->in_digest);
+  const BYTE *info_in = take(r, info_size, sizeof(UINT32));
+  if (!info_in)
+    return TPM_E_BAD_PARAM_SIZE;
+  unmarshal_UINT32(&size, &r->in, &r->in_digest);
+  const BYTE *data = take(r, size, 0);
+  if (!data)
+    return TPM_E_BAD_PARAM_SIZE;
+  TPM_RESULT res = auth_check(r, 0, &srk_auth);
+  if (res)
+    return res;
+
+  // the authorization data of the blob is encrypted with the OSAP secret
+  struct auth *a = r->auth;
+  if (!a->session->osap)
+    return TPM_E_AUTHFAIL;
+  if (key != TPM_KH_SRK)
+    return TPM_E_INVALID_KEYHANDLE;
+  if (info_size > sizeof(info) || !pcr_info_parse(info_in, info_size, &pi))
+    return TPM_E_BAD_PARAMETER;
+  if (size > sizeof(blob.data))
+    return TPM_E_BAD_DATASIZE;
+
+  // the TPM fills in the state at creation itself
+  memcpy(info, info_in, info_size);
+  info[2] = 1 << r->locality;
+  TPM_COMPOSITE_HASH composite = pcr_composite(info + pi.creation);
+  memcpy(info + pi.digests, &composite, sizeof(TPM_COMPOSITE_HASH));
+
+  SHA1_Context ctx;
+  sha1_init(&ctx);
+  sha1_stream(&ctx, info, info_size);
+  sha1_finish(&ctx);
+  blob.info_digest = ctx.hash;
+  blob.auth = encAuth_gen(encAuth, a->session->secret, a->session->nonceEven);
+  blob.sealx = r->ordinal == TPM_ORD_Sealx;
+  memcpy(blob.data, data, size);
+  if (blob.sealx)
+    sealx_mask(a, blob.data, size);
+  size += SEALED_HEADER_SIZE;
+  mgf1_xor(tpm->proof.authdata, sizeof(TPM_SECRET), (BYTE *)&blob, size);
+
+  marshal_UINT16(TPM_TAG_STORED_DATA12, &r->out, &r->out_digest);
+  marshal_UINT16(0, &r->out, &r->out_digest);
+  marshal_UINT32(info_size, &r->out, &r->out_digest);
+  marshal_array(info, info_size, &r->out, &r->out_digest);
+  marshal_UINT32(size, &r->out, &r->out_digest);
+  marshal_array(&blob, size, &r->out, &r->out_digest);
+
+  // an OSAP session that encrypted authorization data ends with the command
+  a->continueAuthSession = FALSE;
+  return auth_reply(r);
+}
+
+static TPM_RESULT unseal(struct request *r) {
+  TPM_KEY_HANDLE key;
+  UINT16 tag, et;
+  UINT32 info_size, size;
+  struct pcr_info pi;
+  struct sealed blob;
+
+  unmarshal_UINT32(&key, &r->in, NULL);
+  unmarshal_UINT16(&tag, &r->in, &r->in_digest);
+  unmarshal_UINT16(&et, &r->in, &r->in_digest);
+  unmarshal_UINT32(&info_size, &r->in, &r->in_digest);
+  const BYTE *info = take(r, info_size, sizeof(UINT32));
+  if (!info)
+    return TPM_E_BAD_PARAM_SIZE;
+  unmarshal_UINT32(&size, &r->in, &r->in_digest);
+  const BYTE *enc = take(r, size, 0);
+  if (!enc)
+    return TPM_E_BAD_PARAM_SIZE;
+  TPM_RESULT res = auth_check(r, 0, &srk_auth);
+  if (res)
+    return res;
+  if (key != TPM_KH_SRK)
+    return TPM_E_INVALID_KEYHANDLE;
+  if (tag != TPM_TAG_STORED_DATA12 || et || size < SEALED_HEADER_SIZE ||
+      size > sizeof(blob))
+    return TPM_E_NOTSEALED_BLOB;
+
+  memcpy(&blob, enc, size);
+  mgf1_xor(tpm->proof.authdata, sizeof(TPM_SECRET), (BYTE *)&blob, size);
+  size -= SEALED_HEADER_SIZE;
+  SHA1_Context ctx;
+  sha1_init(&ctx);
+  sha1_stream(&ctx, info, info_size);
+  sha1_finish(&ctx);
+  if (memcmp(&ctx.hash, &blob.info_digest, sizeof(TPM_DIGEST)) ||
+      !pcr_info_parse(info, info_size, &pi))
+    return TPM_E_NOTSEALED_BLOB;
+
+  if (!(info[3] & 1 << r->locality))
+    return TPM_E_BAD_LOCALITY;
+  TPM_COMPOSITE_HASH composite = pcr_composite(info + pi.release);
+  if (memcmp(&composite, info + pi.digests + sizeof(TPM_DIGEST),
+             sizeof(TPM_COMPOSITE_HASH)))
+    return TPM_E_WRONGPCRVAL;
+  res = auth_check(r, 1, &blob.auth);
+  if (res)
+    return res;
+
+  tpm->stats.unsealed_size = size;
+  memcpy(tpm->stats.unsealed, blob.data, size);
+  if (blob.sealx) {
+    if (!r->auth[0].session->osap)
+      return TPM_E_AUTHFAIL;
+    sealx_mask(r->auth, blob.data, size);
+  }
+  marshal_UINT32(size, &r->out, &r->out_digest);
+  marshal_array(blob.data, size, &r->out, &r->out_digest);
+  return auth_reply(r);
+}
+
+/*
+ * The commands of the model. The typical execution times are in the range
+ * of TPM 1.2 chips on the LPC bus.
+ */
+static struct command {
+  TPM_COMMAND_CODE ordinal;
+  const char *name;
+  TPM_RESULT (*run)(struct request *r);
+  unsigned int auths;
+  UINT32 params; // size of the fixed parameters
+  UINT32 latency_us;
+} commands[] = {
+    {TPM_ORD_Startup, "Startup", startup, 0, 2, 20000},
+    {TPM_ORD_ContinueSelfTest, "ContinueSelfTest", continue_self_test, 0, 0,
+     300000},
+    {TPM_ORD_GetCapability, "GetCapability", get_capability, 0, 8, 1000},
+    {TPM_ORD_PcrRead, "PcrRead", pcr_read, 0, 4, 1000},
+    {TPM_ORD_Extend, "Extend", extend, 0, 24, 6000},
+    {TPM_ORD_GetRandom, "GetRandom", get_random, 0, 4, 20000},
+    {TPM_ORD_OIAP, "OIAP", oiap, 0, 0, 3000},
+    {TPM_ORD_OSAP, "OSAP", osap, 0, 26, 5000},
+    {TPM_ORD_FlushSpecific, "FlushSpecific", flush_specific, 0, 8, 1000},
+    {TPM_ORD_NV_WriteValueAuth, "NV_WriteValueAuth", nv_write_value_auth, 1,
+     12, 30000},
+    {TPM_ORD_NV_ReadValue, "NV_ReadValue", nv_read_value, 0, 12, 10000},
+    {TPM_ORD_Seal, "Seal", seal, 1, 32, 80000},
+    {TPM_ORD_Sealx, "Sealx", seal, 1, 32, 80000},
+    {TPM_ORD_Unseal, "Unseal", unseal, 2, 16, 400000},
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static bool model_timed;
+
+static const struct command *find_command(TPM_COMMAND_CODE ordinal) {
+  for (unsigned i = 0; i < COMMAND_COUNT; i++)
+    if (commands[i].ordinal == ordinal)
+      return commands + i;
+  return NULL;
+}
+
+bool tpm_model_set_latency(const char *name, UINT32 us) {
+  for (unsigned i = 0; i < COMMAND_COUNT; i++)
+    if (strlen(name) == strlen(commands[i].name) &&
+        !memcmp(name, commands[i].name, strlen(name))) {
+      commands[i].latency_us = us;
+      return true;
+    }
+  return false;
+}
+
+void tpm_model_timed(bool timed) { model_timed = timed; }
+
+void tpm_model_init(TPM_NV_INDEX nv_index, UINT32 nv_size,
+                    TPM_AUTHDATA nv_auth) {
+  tpm = shim_shared(sizeof(*tpm));
+  if (!tpm) {
+    out_info("no shared memory for the TPM model");
+    exit(1);
+  }
+  tpm_model_stats = &tpm->stats;
+  tpm->nv_index = nv_index;
+  tpm->nv_size = nv_size < NV_MAX ? nv_size : NV_MAX;
+  tpm->nv_auth = nv_auth;
+  tpm->random = 0x2545f491;
+  random_bytes(&tpm->proof, sizeof(TPM_SECRET));
+}
+
+void tpm_model_boot(void) {
+  memset(&state, 0, sizeof(state));
+  // the dynamic PCRs are -1 until a late launch resets them
+  memset(state.pcr + 17, 0xff, 6 * sizeof(TPM_PCRVALUE));
+  state.next_handle = FIRST_AUTH_HANDLE;
+}
+
+void tpm_model_launch(TPM_DIGEST slb) {
+  memset(state.pcr + 17, 0, 6 * sizeof(TPM_PCRVALUE));
+  pcr_extend(17, slb);
+}
+
+UINT32 tpm_model_execute(unsigned int locality, const BYTE *in, UINT32 size,
+                         BYTE *out, UINT32 max, UINT32 *latency_us) {
+  struct request r = {.locality = locality};
+  const struct command *c = NULL;
+  TPM_TAG tag = 0;
+  UINT32 param_size = 0, ordinal = 0;
+  TPM_RESULT res;
+
+  tpm->stats.commands++;
+  *latency_us = 0;
+  unpack_init(&r.in, in, size);
+  pack_init(&r.out, out, max);
+  sha1_init(&r.in_digest);
+  sha1_init(&r.out_digest);
+  if (size >= HEADER_SIZE) {
+    unmarshal_UINT16(&tag, &r.in, NULL);
+    unmarshal_UINT32(&param_size, &r.in, NULL);
+    unmarshal_UINT32(&ordinal, &r.in, &r.in_digest);
+    r.ordinal = ordinal;
+    c = find_command(ordinal);
+  }
+  r.auths = tag - TPM_TAG_RQU_COMMAND;
+  // the header is written last
+  r.out.bytes_packed = HEADER_SIZE;
+  marshal_UINT32(TPM_SUCCESS, NULL, &r.out_digest);
+  marshal_UINT32(r.ordinal, NULL, &r.out_digest);
+
+  if (size < HEADER_SIZE || param_size != size)
+    res = TPM_E_BAD_PARAM_SIZE;
+  else if (size > INPUT_BUFFER_SIZE)
+    res = TPM_E_SIZE;
+  else if (tag < TPM_TAG_RQU_COMMAND || tag > TPM_TAG_RQU_AUTH2_COMMAND)
+    res = TPM_E_BADTAG;
+  else if (!c)
+    res = TPM_E_BAD_ORDINAL;
+  else if (r.auths != c->auths)
+    res = TPM_E_BADTAG;
+  else if (size < HEADER_SIZE + c->params + r.auths * AUTH_TRAILER_SIZE)
+    res = TPM_E_BAD_PARAM_SIZE;
+  else if (!state.started && r.ordinal != TPM_ORD_Startup)
+    res = TPM_E_INVALID_POSTINIT;
+  else {
+    // the parameters end where the authorization sessions begin
+    r.in.size -= r.auths * AUTH_TRAILER_SIZE;
+    // all but these run the self-test first, if it has not run yet
+    bool untested = !state.tested && r.ordinal != TPM_ORD_Startup &&
+                    r.ordinal != TPM_ORD_GetCapability &&
+                    r.ordinal != TPM_ORD_ContinueSelfTest;
+    res = c->run(&r);
+    *latency_us = model_timed ? c->latency_us : 0;
+    if (untested) {
+      state.tested = true;
+      if (model_timed)
+        *latency_us += find_command(TPM_ORD_ContinueSelfTest)->latency_us;
+    }
+  }
+
+  if (res) {
+    // an error has no output parameters and ends the sessions of the command
+    for (unsigned i = 0; i < 2; i++)
+      if (r.auth[i].session)
+        r.auth[i].session->handle = 0;
+    r.out.bytes_packed = HEADER_SIZE;
+    tpm->stats.failures++;
+  }
+  UINT32 out_size = r.out.bytes_packed;
+  pack_init(&r.out, out, HEADER_SIZE);
+  marshal_UINT16(res ? TPM_TAG_RSP_COMMAND : TPM_TAG_RSP_COMMAND + r.auths,
+                 &r.out, NULL);
+  marshal_UINT32(out_size, &r.out, NULL);
+  marshal_UINT32(res, &r.out, NULL);
+  return out_size;
+}
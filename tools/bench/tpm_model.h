@@ -0,0 +1,42 @@
+#ifndef __TPM_MODEL_H__
+#define __TPM_MODEL_H__
+
+/*
+ * \brief   header of tpm_model.c
+ */
+
+#include "platform.h"
+#include "tcg.h"
+
+/* Allocate the state of the TPM, which survives the boots of the children,
+ * with an owner-defined NV space. The SRK has the well-known secret. */
+void tpm_model_init(TPM_NV_INDEX nv_index, UINT32 nv_size,
+                    TPM_AUTHDATA nv_auth);
+/* Power on: forget PCRs, sessions, TPM_Startup and the self-test, keep the
+ * NV contents */
+void tpm_model_boot(void);
+/* Late launch: reset PCRs 17-22 and extend PCR 17 with the SLB hash */
+void tpm_model_launch(TPM_DIGEST slb);
+
+/* Set the execution time of a command in microseconds, instead of the time
+ * it takes on a typical TPM 1.2. Returns false if the ordinal name is not
+ * known to the model. */
+bool tpm_model_set_latency(const char *name, UINT32 us);
+/* Whether commands take their execution time, or none at all */
+void tpm_model_timed(bool timed);
+
+/* Execute the command in and write the response to out. Returns the size of
+ * the response and the time the TPM takes for it. */
+UINT32 tpm_model_execute(unsigned int locality, const BYTE *in, UINT32 size,
+                         BYTE *out, UINT32 max, UINT32 *latency_us);
+
+struct tpm_model_stats {
+  UINT32 commands;
+  UINT32 failures;
+  UINT32 reused_nonces; // nonceOdd of a session sent twice in a row
+  UINT32 unsealed_size;
+  BYTE unsealed[128];
+};
+extern struct tpm_model_stats *tpm_model_stats;
+
+#endif